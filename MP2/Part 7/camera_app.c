@@ -14,15 +14,24 @@
  *
  * NOTES:
  * 02/04/14 by JAZ::Design created.
+ *
+ * pixel422.h and integral_image.h live in the repository's common/
+ * directory: add ../../common (from this directory) to the SDK project's
+ * include paths, under C/C++ Build > Settings > ARM gcc compiler >
+ * Directories.
  *****************************************************************************/
 
 #include "camera_app.h"
+#include "gallery.h"
+#include "pixel422.h"
+#include "integral_image.h"
 
 
 #define DISP_WIDTH 1920
 #define DISP_HEIGHT 1080
-#define IMG_BUF 30
+#define BURST_FRAMES 16
 #define NEIGHBORS 8
+#define SOBEL_BLUR_RADIUS 1   // Box blur before edge detection, 0 = none
 
 // Sobel kerns for edge detection
 int sobel_kern_x[3][3] = {
@@ -37,6 +46,9 @@ int sobel_kern_y[3][3] = {
     { 1,  2,  1}
 };
 
+// Summed-area table for the blur
+static Xuint32 sobel_sat[INTEGRAL_WORDS(DISP_WIDTH, DISP_HEIGHT)];
+
 
 camera_config_t camera_config;
 
@@ -74,13 +86,23 @@ void camera_config_init(camera_config_t *config) {
 }
 
 
-void sobel_edge_detect(unsigned char* img, char threshold) {
+// Sobel edge detection on an image box-blurred over blur_radius pixels
+// first (0 for none). The blur costs the same for any radius, from a
+// summed-area table.
+void sobel_edge_detect(unsigned char* img, char threshold, int blur_radius) {
 	unsigned char res_img[DISP_HEIGHT * DISP_WIDTH];
 	int grad_x;
 	int grad_y;
 	int dx;
 	int dy;
 	unsigned char pixel;
+	integral_t sat;
+
+	// Noise makes edges of its own
+	if(blur_radius > 0){
+		integral_init(&sat, DISP_WIDTH, DISP_HEIGHT, (uint32_t *)sobel_sat);
+		integral_box_blur(&sat, img, DISP_WIDTH, blur_radius);
+	}
 
     for (int y = 1; y < DISP_HEIGHT - 1; y++) {
         for (int x = 1; x < DISP_WIDTH - 1; x++) {
@@ -156,7 +178,6 @@ void get_neighbors(int cur_x, int cur_y, Xuint16* neighbors, Xuint16* pS2MM_Mem)
 }
 
 
-Xuint16 images[IMG_BUF][DISP_HEIGHT * DISP_WIDTH];
 // Main (SW) processing loop. Recommended to have an explicit exit condition
 void camera_loop(camera_config_t *config) {
 
@@ -195,11 +216,18 @@ void camera_loop(camera_config_t *config) {
     int *sw_addr = (int *)XPAR_GPIO_1_BASEADDR;
     int *btn_addr = (int *)XPAR_GPIO_0_BASEADDR;
     int max_index = 0;
+    gallery_burst_t burst;
+    playback_t playback;
+    int playing = 0;
+    int btn_prev = 0, btn_pressed;
+    int clip_first, clip_last;
 
 
+    gallery_init();
+    max_index = gallery_count();
+    playback_init(&playback, config);
 
-
-    unsigned char img_index = 0;
+    unsigned char img_index = max_index;
 
     int frame_counter = 0;
     // Part 7
@@ -213,23 +241,39 @@ void camera_loop(camera_config_t *config) {
 			frame_counter++;
 
     	}
+    	if(playing && (*sw_addr & 0x00000003) != 0){
+    		playback_stop(&playback);
+    		playing = 0;
+    	}
     	if((*sw_addr & 0x00000001) != 0){
 			// Middle Button Press
 			if((*btn_addr & 0x00000001) != 0){
-				if(img_index < IMG_BUF){
-					xil_printf("Taking a Picture, Smile ;)\n\r");
-					// Capture Frame, increment index, sleep
-					for (i = 0; i < DISP_WIDTH*DISP_HEIGHT; i++) {
-						images[img_index][i] = 	pS2MM_Mem[i];
-						pMM2S_Mem[i] = images[img_index][i];
-					}
-					img_index += (img_index < IMG_BUF )? 1 : 0;
-					max_index = (img_index > max_index)? img_index : max_index;
+				xil_printf("Taking a Picture, Smile ;)\n\r");
+				// Capture Frame, show it, sleep
+				if(gallery_capture(pS2MM_Mem) >= 0){
+					max_index = gallery_count();
+					img_index = max_index;
+					gallery_load(img_index - 1, (Xuint16 *)pMM2S_Mem);
 					xil_printf("MAX : %d\n\r", max_index);
 					sleep(2);
 				}else{
 					xil_printf("You have no room left in your photo gallery :(\n\r");
 				}
+			// Down Button Press
+			}else if((*btn_addr & 0x00000002) != 0){
+				// Burst at the sensor frame rate, compression happens later while idle
+				xil_printf("Burst of %d frames\n\r", BURST_FRAMES);
+				if(gallery_burst(config, BURST_FRAMES, &burst) > 0){
+					xil_printf("Burst: %d frames in %d us (%d.%02d fps), %d dropped\n\r", burst.uFrames,
+							burst.uElapsedUs, burst.uFpsX100 / 100, burst.uFpsX100 % 100, burst.uDropped);
+					max_index = gallery_count();
+					img_index = max_index;
+					gallery_load(img_index - 1, (Xuint16 *)pMM2S_Mem);
+					// Wait for release so one press is one burst
+					while((*btn_addr & 0x00000002) != 0);
+				}else{
+					xil_printf("You have no room left in your photo gallery :(\n\r");
+				}
 			}else{
 				for (i = 0; i < DISP_WIDTH*DISP_HEIGHT; i++) {
 					pMM2S_Mem[i] = pS2MM_Mem[i];
@@ -238,26 +282,49 @@ void camera_loop(camera_config_t *config) {
     	}else{
     	// Play Mode
     		if(max_index != 0){
+			if(!playing){
+				playback_start(&playback, PLAYBACK_STILL, img_index - 1);
+				playing = 1;
+			}
+			btn_pressed = *btn_addr & ~btn_prev;
+
 			// Left Button Press
-			if((*btn_addr & 0x00000004) != 0){
+			if((btn_pressed & 0x00000004) != 0){
 				// Decrement img index
-				img_index -= (img_index > 1)? 1 : 0;
-				xil_printf("IMG INDEX : %d\n\r", img_index - 1);
+				playback_step(&playback, -1);
+				xil_printf("IMG INDEX : %d\n\r", playback.index);
 			}
 
 			// Right Button Press
-			if((*btn_addr & 0x00000008) != 0){
+			if((btn_pressed & 0x00000008) != 0){
 				// Increment img index
-				img_index += (img_index < max_index)? 1 : 0;
-				xil_printf("IMG INDEX : %d\n\r", img_index - 1);
+				playback_step(&playback, 1);
+				xil_printf("IMG INDEX : %d\n\r", playback.index);
 			}
 
-			// Display image at current img index
-			for (i = 0; i < DISP_WIDTH*DISP_HEIGHT; i++) {
-				pMM2S_Mem[i] = images[img_index - 1][i];
+			// Middle Button Press: play the burst this image is from, or a slideshow
+			// for single shots. Pressing again goes back to stepping.
+			if((btn_pressed & 0x00000001) != 0){
+				if(playback.mode != PLAYBACK_STILL){
+					playback_start(&playback, PLAYBACK_STILL, playback.index);
+					xil_printf("Playback stopped\n\r");
+				}else if(gallery_clip_range(playback.index, &clip_first, &clip_last) != 0){
+					playback_start(&playback, PLAYBACK_CLIP, clip_first);
+					xil_printf("Playing clip, images %d - %d\n\r", clip_first, clip_last);
+				}else{
+					playback_start(&playback, PLAYBACK_SLIDESHOW, playback.index);
+					xil_printf("Slideshow\n\r");
+				}
+			}
+
+			// Down Button Press: cycle 0.25x, 0.5x, 1x, 2x, 4x
+			if((btn_pressed & 0x00000002) != 0){
+				playback_set_speed(&playback, (playback.uSpeedX4 >= PLAYBACK_SPEED_MAX)? 1 : playback.uSpeedX4 * 2);
+				xil_printf("Speed : %d/4\n\r", playback.uSpeedX4);
 			}
 
-			sleep(0.5);
+			// Display image at current img index, paced by the display frame rate
+			img_index = playback_tick(&playback) + 1;
     		}else{
     			xil_printf("You have no captured images to view..\n\r");
 				for (i = 0; i < DISP_WIDTH*DISP_HEIGHT; i++) {
@@ -265,10 +332,19 @@ void camera_loop(camera_config_t *config) {
 				}
     		}
     	}
+    	btn_prev = *btn_addr;
+
+    	// Compress pending captures while no button is held and nothing is playing
+    	if((*btn_addr & 0x0000001F) == 0 && (!playing || playback.mode == PLAYBACK_STILL)){
+    		gallery_compact_step();
+    	}
 
     	// Top button exits loop
     	if((*btn_addr & 0x00000010) != 0){
     		xil_printf("Exiting.. \n\r");
+    		if(playing){
+    			playback_stop(&playback);
+    		}
     		break;
     	}
 
@@ -281,10 +357,9 @@ void camera_loop(camera_config_t *config) {
 	int red_ch = 0, grn_ch = 0, blue_ch = 0;
 	unsigned char Y = 0;
 	unsigned char Y0[DISP_WIDTH*DISP_HEIGHT];
-	Xuint16 Cb0[DISP_WIDTH*DISP_HEIGHT], Cr0[DISP_WIDTH*DISP_HEIGHT];
+	unsigned char Cb0[DISP_WIDTH*DISP_HEIGHT/2], Cr0[DISP_WIDTH*DISP_HEIGHT/2];	// One per pixel pair
 	Xuint16 Cb = 0, Cr = 0;
 	int x = 0, y = 0;
-	Xuint16 cur_pixel_dat = 0;
 	Xuint16 neighbors[NEIGHBORS];
 	unsigned char threshold = 40;
 	unsigned char sobel = 0;
@@ -302,6 +377,8 @@ void camera_loop(camera_config_t *config) {
 	// Run for 1000 frames before going back to HW mode
 	for (j = 1; j < 1000; j++) {
 		xil_printf("Cur Frame : %d\n\r", j);
+		// SW2 shows the edges, SW3 leaves out the blur before them
+		sobel = (*sw_addr & 0x00000004) != 0;
 		for (i = 0; i < DISP_WIDTH*DISP_HEIGHT; i++) {
 			x = i % DISP_WIDTH;
 			y += (x == 0 && i != 0)? 1 : 0;
@@ -334,17 +411,15 @@ void camera_loop(camera_config_t *config) {
 			   //	  *pStorageMem++ = 0xF0525A52;  // Red
 			   // }
 			Y0[i] = (unsigned char)(0.183 * red_ch + 0.614 * grn_ch + 0.062 * blue_ch + 16);
-			if(sobel == 0){
-				if(x % 2 == 0){
-					Cb0[i] = (Xuint16)(-0.101 * red_ch - 0.338 * grn_ch + 0.439 * blue_ch + 128);
-					Cr0[i] = (Xuint16)(0.439 * red_ch - 0.399 * grn_ch - 0.040 * blue_ch + 128);
+			// Chroma from the even pixel of each pair
+			if(x % 2 == 0){
+				if(sobel == 0){
+					Cb0[i / 2] = (unsigned char)(-0.101 * red_ch - 0.338 * grn_ch + 0.439 * blue_ch + 128);
+					Cr0[i / 2] = (unsigned char)(0.439 * red_ch - 0.399 * grn_ch - 0.040 * blue_ch + 128);
 				}else{
-					Cb0[i] = Cb0[i - 1];
-					Cr0[i] = Cr0[i - 1];
+					Cb0[i / 2] = 128;
+					Cr0[i / 2] = 128;
 				}
-			}else{
-				Cb0[i] = 128;
-				Cr0[i] = 128;
 			}
 		/*
 			if(j == 0 && i == 0){
@@ -364,17 +439,10 @@ void camera_loop(camera_config_t *config) {
 		}
 		y = 0;
 		if(sobel == 1){
-			sobel_edge_detect(Y0, threshold);
-		}
-		for (i = 0; i < DISP_WIDTH*DISP_HEIGHT; i++) {
-			if(i % 2 == 0){
-				cur_pixel_dat =  (Xuint16)((Cb0[i] & 0xFF) << 8)|(Y0[i] & 0xFF);
-			}else{
-				cur_pixel_dat = (Xuint16)((Cr0[i - 1] & 0xFF) << 8)|(Y0[i] & 0xFF);
-			}
-
-			pMM2S_Mem[i] = cur_pixel_dat;
+			sobel_edge_detect(Y0, threshold, (*sw_addr & 0x00000008) ? 0 : SOBEL_BLUR_RADIUS);
 		}
+		// (Cb << 8 | Y0), (Cr << 8 | Y1) halfwords are one 4:2:2 word per pair
+		pix422_pack(Y0, Cb0, Cr0, DISP_WIDTH*DISP_HEIGHT/2, (Xuint32 *)pMM2S_Mem);
 	}
 
 
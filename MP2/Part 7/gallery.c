@@ -0,0 +1,417 @@
+/*****************************************************************************
+ * gallery.c - photo gallery storage. Single shots and bursts are appended
+ * to a pool in reserved DDR. Nothing is compressed while capturing; the main
+ * loop calls gallery_compact_step() when idle, which run-length codes one
+ * image at a time and slides it down to the end of the packed region.
+ *****************************************************************************/
+
+#include <string.h>
+#include "gallery.h"
+#include "xil_cache.h"
+
+
+#define GALLERY_ALIGN              64          // Cache line, and keeps VDMA addresses aligned
+#define RLE32_RUN_FLAG             0x80000000  // Header is a run: [flag | count][value]
+#define RLE32_MAX_COUNT            0x7FFFFFFF  // Otherwise a literal: [count][count words]
+#define RLE32_MIN_RUN              3
+
+#define GALLERY_ALIGN_UP(x)        (((x) + GALLERY_ALIGN - 1) & ~(GALLERY_ALIGN - 1))
+#define GALLERY_POOL_ADDR(off)     (GALLERY_BASE_ADDR + GALLERY_POOL_OFFSET + (off))
+
+
+static gallery_t *gallery = (gallery_t *)GALLERY_BASE_ADDR;
+
+// Compression output. Encoding gives up once it stops being smaller than the
+// input, so one frame's worth is enough.
+static Xuint32 gallery_scratch[GALLERY_FRAME_BYTES / 4];
+
+
+// Write the directory back to DDR so it survives a restart of the application
+static void gallery_sync(void)
+{
+	Xil_DCacheFlushRange((INTPTR)gallery, sizeof(gallery_t));
+}
+
+
+// Load the directory left by a previous run, or start an empty gallery
+void gallery_init(void)
+{
+	if (gallery->uMagic != GALLERY_MAGIC || gallery->uNumImages > GALLERY_MAX_IMAGES ||
+			gallery->uPoolUsed > GALLERY_POOL_BYTES || gallery->uNumPacked > gallery->uNumImages) {
+		memset(gallery, 0, sizeof(gallery_t));
+		gallery->uMagic = GALLERY_MAGIC;
+		gallery->uNextClipId = 1;
+		gallery_sync();
+	}
+
+	xil_printf("Gallery: %d images, %d KB of %d KB used\n\r", gallery->uNumImages,
+			gallery->uPoolUsed >> 10, GALLERY_POOL_BYTES >> 10);
+}
+
+
+int gallery_count(void)
+{
+	return gallery->uNumImages;
+}
+
+
+// Encode nWords 32-bit words. Returns the encoded size in bytes, or 0 when the
+// result would not be smaller than the input.
+static Xuint32 rle32_encode(const Xuint32 *pSrc, Xuint32 nWords, Xuint32 *pDst)
+{
+	Xuint32 i = 0, o = 0;
+	Xuint32 run, lit, start;
+
+	while (i < nWords) {
+		run = 1;
+		while (i + run < nWords && pSrc[i + run] == pSrc[i] && run < RLE32_MAX_COUNT) {
+			run++;
+		}
+
+		if (run >= RLE32_MIN_RUN) {
+			if (o + 2 >= nWords) {
+				return 0;
+			}
+			pDst[o++] = RLE32_RUN_FLAG | run;
+			pDst[o++] = pSrc[i];
+			i += run;
+		}
+		else {
+			// Extend the literal up to the start of the next run
+			start = i;
+			lit = 0;
+			while (i < nWords && lit < RLE32_MAX_COUNT) {
+				if (i + RLE32_MIN_RUN <= nWords && pSrc[i] == pSrc[i + 1] && pSrc[i] == pSrc[i + 2]) {
+					break;
+				}
+				i++;
+				lit++;
+			}
+			if (o + 1 + lit >= nWords) {
+				return 0;
+			}
+			pDst[o++] = lit;
+			memcpy(&pDst[o], &pSrc[start], lit * 4);
+			o += lit;
+		}
+	}
+
+	return o * 4;
+}
+
+
+static void rle32_decode(const Xuint32 *pSrc, Xuint32 nBytes, Xuint32 *pDst)
+{
+	const Xuint32 *pEnd = pSrc + (nBytes / 4);
+	Xuint32 count, value;
+
+	while (pSrc < pEnd) {
+		count = *pSrc++;
+		if (count & RLE32_RUN_FLAG) {
+			count &= ~RLE32_RUN_FLAG;
+			value = *pSrc++;
+			while (count--) {
+				*pDst++ = value;
+			}
+		}
+		else {
+			memcpy(pDst, pSrc, count * 4);
+			pDst += count;
+			pSrc += count;
+		}
+	}
+}
+
+
+// Append nFrames raw frame slots to the pool. Returns the first index, or -1
+// if the gallery is full.
+static int gallery_reserve(int nFrames)
+{
+	Xuint32 uOffset;
+	int first, k;
+
+	if (nFrames <= 0 || gallery->uNumImages + nFrames > GALLERY_MAX_IMAGES) {
+		return -1;
+	}
+
+	// Space only comes back once every pending image has been compacted
+	while (GALLERY_ALIGN_UP(gallery->uPoolUsed) + nFrames * GALLERY_FRAME_BYTES > GALLERY_POOL_BYTES &&
+			gallery_compact_step()) {
+	}
+	uOffset = GALLERY_ALIGN_UP(gallery->uPoolUsed);
+	if (uOffset + nFrames * GALLERY_FRAME_BYTES > GALLERY_POOL_BYTES) {
+		return -1;
+	}
+
+	first = gallery->uNumImages;
+	for (k = 0; k < nFrames; k++) {
+		gallery->entries[first + k].uFormat = GALLERY_FMT_RAW422;
+		gallery->entries[first + k].uOffset = uOffset;
+		gallery->entries[first + k].uSize = GALLERY_FRAME_BYTES;
+		gallery->entries[first + k].uClipId = 0;
+		gallery->entries[first + k].uTimestamp = 0;
+		uOffset += GALLERY_FRAME_BYTES;
+	}
+	gallery->uNumImages += nFrames;
+	gallery->uPoolUsed = uOffset;
+
+	return first;
+}
+
+
+// Drop entries [first, uNumImages), e.g. after an aborted burst
+static void gallery_release(int first)
+{
+	gallery->uNumImages = first;
+	if (gallery->uNumPacked > gallery->uNumImages) {
+		gallery->uNumPacked = gallery->uNumImages;
+	}
+	gallery->uPoolUsed = (first == 0) ? 0 : gallery->entries[first - 1].uOffset + gallery->entries[first - 1].uSize;
+}
+
+
+// Store a single shot from a live frame buffer. Returns the image index, or -1.
+int gallery_capture(volatile Xuint16 *pSrc)
+{
+	XTime tNow;
+	int index;
+
+	index = gallery_reserve(1);
+	if (index < 0) {
+		return -1;
+	}
+
+	Xil_DCacheInvalidateRange((INTPTR)pSrc, GALLERY_FRAME_BYTES);
+	memcpy((void *)GALLERY_POOL_ADDR(gallery->entries[index].uOffset), (const void *)pSrc, GALLERY_FRAME_BYTES);
+	Xil_DCacheFlushRange(GALLERY_POOL_ADDR(gallery->entries[index].uOffset), GALLERY_FRAME_BYTES);
+
+	XTime_GetTime(&tNow);
+	gallery->entries[index].uTimestamp = (Xuint32)tNow;
+	gallery_sync();
+
+	return index;
+}
+
+
+// Poll the S2MM frame count flag, which is raised at the end of every frame
+// once the IRQ frame count threshold is 1. Returns non-zero on timeout.
+static int gallery_wait_frame(u32 uBaseAddr, XTime *pTime)
+{
+	XTime tStart, tNow;
+
+	XTime_GetTime(&tStart);
+	while ((XAxiVdma_ReadReg(uBaseAddr, XAXIVDMA_RX_OFFSET+XAXIVDMA_SR_OFFSET) & XAXIVDMA_IXR_FRMCNT_MASK) == 0) {
+		XTime_GetTime(&tNow);
+		if (tNow - tStart > COUNTS_PER_SECOND / 10) {
+			return 1;
+		}
+	}
+	XTime_GetTime(pTime);
+	XAxiVdma_WriteReg(uBaseAddr, XAXIVDMA_RX_OFFSET+XAXIVDMA_SR_OFFSET, XAXIVDMA_IXR_FRMCNT_MASK);
+
+	return 0;
+}
+
+
+// Capture nFrames consecutive sensor frames into new gallery slots. Returns
+// the number of frames stored, or -1 if there is no room for the burst.
+int gallery_burst(camera_config_t *config, int nFrames, gallery_burst_t *pBurst)
+{
+	u32 uBaseAddr = config->vdma_hdmi.BaseAddr;
+	u32 uDMACR;
+	XTime tStart, tPrev, tNow;
+	XTime tPeriod = COUNTS_PER_SECOND / GALLERY_FRAME_RATE;
+	Xuint32 uClipId, uSlot;
+	int first, k;
+#if GALLERY_BURST_VDMA_REDIRECT
+	u32 uStartAddr, uVSize;
+#else
+	u32 uParkPtr, uStoreAddr[2];
+	int store;
+#endif
+
+	first = gallery_reserve(nFrames);
+	if (first < 0) {
+		return -1;
+	}
+	uClipId = gallery->uNextClipId++;
+
+	// No dirty lines may be evicted on top of the incoming frames
+	Xil_DCacheInvalidateRange(GALLERY_POOL_ADDR(gallery->entries[first].uOffset), nFrames * GALLERY_FRAME_BYTES);
+
+	pBurst->uFirst = first;
+	pBurst->uFrames = 0;
+	pBurst->uDropped = 0;
+
+	// Raise the frame count flag at the end of every frame
+	uDMACR = XAxiVdma_ReadReg(uBaseAddr, XAXIVDMA_RX_OFFSET+XAXIVDMA_CR_OFFSET);
+	XAxiVdma_WriteReg(uBaseAddr, XAXIVDMA_RX_OFFSET+XAXIVDMA_CR_OFFSET, (uDMACR & ~XAXIVDMA_FRMCNT_MASK) | (1 << XAXIVDMA_FRMCNT_SHIFT));
+	XAxiVdma_WriteReg(uBaseAddr, XAXIVDMA_RX_OFFSET+XAXIVDMA_SR_OFFSET, XAXIVDMA_IXR_FRMCNT_MASK);
+
+#if GALLERY_BURST_VDMA_REDIRECT
+	uStartAddr = XAxiVdma_ReadReg(uBaseAddr, XAXIVDMA_S2MM_ADDR_OFFSET+XAXIVDMA_START_ADDR_OFFSET);
+	uVSize = XAxiVdma_ReadReg(uBaseAddr, XAXIVDMA_S2MM_ADDR_OFFSET+XAXIVDMA_VSIZE_OFFSET);
+
+	if (gallery_wait_frame(uBaseAddr, &tStart) == 0) {
+		tPrev = tStart;
+		for (k = 0; k < nFrames; k++) {
+			// Point the parked frame store at the slot. The new address is latched by
+			// the VSIZE write and used from the next frame start, which is still in
+			// vertical blanking here.
+			uSlot = GALLERY_POOL_ADDR(gallery->entries[first + k].uOffset);
+			XAxiVdma_WriteReg(uBaseAddr, XAXIVDMA_S2MM_ADDR_OFFSET+XAXIVDMA_START_ADDR_OFFSET, uSlot);
+			XAxiVdma_WriteReg(uBaseAddr, XAXIVDMA_S2MM_ADDR_OFFSET+XAXIVDMA_VSIZE_OFFSET, uVSize);
+
+			if (gallery_wait_frame(uBaseAddr, &tNow)) {
+				break;
+			}
+			pBurst->uDropped += (Xuint32)((tNow - tPrev + tPeriod / 2) / tPeriod) - 1;
+			gallery->entries[first + k].uClipId = uClipId;
+			gallery->entries[first + k].uTimestamp = (Xuint32)tNow;
+			pBurst->uFrames++;
+			tPrev = tNow;
+		}
+	}
+
+	XAxiVdma_WriteReg(uBaseAddr, XAXIVDMA_S2MM_ADDR_OFFSET+XAXIVDMA_START_ADDR_OFFSET, uStartAddr);
+	XAxiVdma_WriteReg(uBaseAddr, XAXIVDMA_S2MM_ADDR_OFFSET+XAXIVDMA_VSIZE_OFFSET, uVSize);
+#else
+	uParkPtr = XAxiVdma_ReadReg(uBaseAddr, XAXIVDMA_PARKPTR_OFFSET);
+	uStoreAddr[0] = XAxiVdma_ReadReg(uBaseAddr, XAXIVDMA_S2MM_ADDR_OFFSET+XAXIVDMA_START_ADDR_OFFSET+0);
+	uStoreAddr[1] = XAxiVdma_ReadReg(uBaseAddr, XAXIVDMA_S2MM_ADDR_OFFSET+XAXIVDMA_START_ADDR_OFFSET+8);
+	store = 0;
+
+	// The first full frame lands in store 0 after this sync
+	if (gallery_wait_frame(uBaseAddr, &tStart) == 0) {
+		tPrev = tStart;
+		for (k = 0; k < nFrames; k++) {
+			if (gallery_wait_frame(uBaseAddr, &tNow)) {
+				break;
+			}
+
+			// Send the next frame to the other store while this one is copied out
+			XAxiVdma_WriteReg(uBaseAddr, XAXIVDMA_PARKPTR_OFFSET,
+					(uParkPtr & ~XAXIVDMA_PARKPTR_WRTREF_MASK) | (((store ^ 1) ? 2 : 0) << XAXIVDMA_WRTREF_SHIFT));
+
+			uSlot = GALLERY_POOL_ADDR(gallery->entries[first + k].uOffset);
+			Xil_DCacheInvalidateRange(uStoreAddr[store], GALLERY_FRAME_BYTES);
+			memcpy((void *)uSlot, (const void *)uStoreAddr[store], GALLERY_FRAME_BYTES);
+			Xil_DCacheFlushRange(uSlot, GALLERY_FRAME_BYTES);
+			store ^= 1;
+
+			pBurst->uDropped += (Xuint32)((tNow - tPrev + tPeriod / 2) / tPeriod) - 1;
+			gallery->entries[first + k].uClipId = uClipId;
+			gallery->entries[first + k].uTimestamp = (Xuint32)tNow;
+			pBurst->uFrames++;
+			tPrev = tNow;
+		}
+	}
+
+	XAxiVdma_WriteReg(uBaseAddr, XAXIVDMA_PARKPTR_OFFSET, uParkPtr);
+#endif
+
+	XAxiVdma_WriteReg(uBaseAddr, XAXIVDMA_RX_OFFSET+XAXIVDMA_CR_OFFSET, uDMACR);
+
+	// Drop any lines the CPU speculatively pulled in while the VDMA was writing
+	Xil_DCacheInvalidateRange(GALLERY_POOL_ADDR(gallery->entries[first].uOffset), nFrames * GALLERY_FRAME_BYTES);
+
+	if (pBurst->uFrames < nFrames) {
+		gallery_release(first + pBurst->uFrames);
+	}
+	if (pBurst->uFrames > 0) {
+		pBurst->uElapsedUs = (Xuint32)((tPrev - tStart) * 1000000 / COUNTS_PER_SECOND);
+		pBurst->uFpsX100 = (Xuint32)((XTime)pBurst->uFrames * 100 * COUNTS_PER_SECOND / (tPrev - tStart));
+	}
+	else {
+		pBurst->uElapsedUs = 0;
+		pBurst->uFpsX100 = 0;
+	}
+	gallery_sync();
+
+	return pBurst->uFrames;
+}
+
+
+// Background phase: compress the next uncompacted image (if that makes it
+// smaller) and slide it down against the packed region. Returns 0 when there
+// is nothing left to do.
+int gallery_compact_step(void)
+{
+	gallery_entry_t *pEntry, *pPrev;
+	Xuint32 uDest, uSize;
+
+	if (gallery->uNumPacked >= gallery->uNumImages) {
+		return 0;
+	}
+
+	pEntry = &gallery->entries[gallery->uNumPacked];
+	pPrev = (gallery->uNumPacked == 0) ? NULL : &gallery->entries[gallery->uNumPacked - 1];
+	uDest = (pPrev == NULL) ? 0 : GALLERY_ALIGN_UP(pPrev->uOffset + pPrev->uSize);
+
+	uSize = 0;
+	if (pEntry->uFormat == GALLERY_FMT_RAW422) {
+		uSize = rle32_encode((const Xuint32 *)GALLERY_POOL_ADDR(pEntry->uOffset), GALLERY_FRAME_BYTES / 4, gallery_scratch);
+	}
+
+	if (uSize != 0) {
+		memcpy((void *)GALLERY_POOL_ADDR(uDest), gallery_scratch, uSize);
+		pEntry->uFormat = GALLERY_FMT_RLE32;
+		pEntry->uSize = uSize;
+	}
+	else if (uDest != pEntry->uOffset) {
+		memmove((void *)GALLERY_POOL_ADDR(uDest), (const void *)GALLERY_POOL_ADDR(pEntry->uOffset), pEntry->uSize);
+	}
+	pEntry->uOffset = uDest;
+	Xil_DCacheFlushRange(GALLERY_POOL_ADDR(uDest), pEntry->uSize);
+
+	gallery->uNumPacked++;
+	if (gallery->uNumPacked == gallery->uNumImages) {
+		gallery->uPoolUsed = pEntry->uOffset + pEntry->uSize;
+	}
+	gallery_sync();
+
+	return 1;
+}
+
+
+// Decode an image into a frame buffer. Returns non-zero for a bad index.
+int gallery_load(int index, Xuint16 *pDst)
+{
+	gallery_entry_t *pEntry;
+
+	if (index < 0 || index >= gallery->uNumImages) {
+		return 1;
+	}
+
+	pEntry = &gallery->entries[index];
+	if (pEntry->uFormat == GALLERY_FMT_RLE32) {
+		rle32_decode((const Xuint32 *)GALLERY_POOL_ADDR(pEntry->uOffset), pEntry->uSize, (Xuint32 *)pDst);
+	}
+	else {
+		memcpy(pDst, (const void *)GALLERY_POOL_ADDR(pEntry->uOffset), GALLERY_FRAME_BYTES);
+	}
+	Xil_DCacheFlushRange((INTPTR)pDst, GALLERY_FRAME_BYTES);
+
+	return 0;
+}
+
+
+// Find the burst an image belongs to. Single shots are a clip of their own.
+// Returns the clip id (0 for a single shot).
+Xuint32 gallery_clip_range(int index, int *pFirst, int *pLast)
+{
+	Xuint32 uClipId = gallery->entries[index].uClipId;
+
+	*pFirst = index;
+	*pLast = index;
+	if (uClipId != 0) {
+		while (*pFirst > 0 && gallery->entries[*pFirst - 1].uClipId == uClipId) {
+			(*pFirst)--;
+		}
+		while (*pLast + 1 < gallery->uNumImages && gallery->entries[*pLast + 1].uClipId == uClipId) {
+			(*pLast)++;
+		}
+	}
+
+	return uClipId;
+}
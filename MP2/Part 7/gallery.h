@@ -0,0 +1,114 @@
+/*****************************************************************************
+ * gallery.h - header file for the photo gallery and its playback engine.
+ * Images live in a reserved DDR region (outside the program image) so that
+ * burst captures can be written straight into their slots by the VDMA.
+ *
+ * Layout of the reserved region:
+ *   GALLERY_BASE_ADDR                 gallery_t directory
+ *   GALLERY_BASE_ADDR + POOL_OFFSET   image pool, entries appended in order
+ *****************************************************************************/
+
+#ifndef __GALLERY_H__
+#define __GALLERY_H__
+
+#include "camera_app.h"
+#include "xtime_l.h"
+
+
+#define GALLERY_FRAME_WIDTH        1920
+#define GALLERY_FRAME_HEIGHT       1080
+#define GALLERY_FRAME_BYTES        (GALLERY_FRAME_WIDTH * GALLERY_FRAME_HEIGHT * 2)
+#define GALLERY_FRAME_RATE         60
+
+#define GALLERY_BASE_ADDR          (XPAR_DDR_MEM_BASEADDR + 0x14000000)
+#define GALLERY_POOL_OFFSET        0x00010000
+#define GALLERY_POOL_BYTES         (30 * GALLERY_FRAME_BYTES)
+#define GALLERY_MAX_IMAGES         64
+#define GALLERY_MAGIC              0x474C4C59   // "GLLY"
+
+// Stored image formats
+#define GALLERY_FMT_RAW422         0   // Uncompressed 4:2:2, as written by the VDMA
+#define GALLERY_FMT_RLE32          1   // Run-length coded 32-bit pixel pairs
+
+// Burst capture path. 1 = re-point the S2MM frame store at each gallery slot
+// so the VDMA writes the frames directly, 0 = ping-pong the S2MM park pointer
+// between frame stores 0 and 2 and bulk copy the finished store.
+#define GALLERY_BURST_VDMA_REDIRECT  1
+
+
+// Playback modes
+#define PLAYBACK_STILL             0   // Hold the current image, step with buttons
+#define PLAYBACK_SLIDESHOW         1   // Advance through the whole gallery
+#define PLAYBACK_CLIP              2   // Play the burst containing the current image
+#define PLAYBACK_SLIDE_TICKS       (3 * GALLERY_FRAME_RATE)  // Slide period at normal speed
+#define PLAYBACK_SPEED_NORMAL      4   // Speeds are in quarters, 1 = 0.25x ... 16 = 4x
+#define PLAYBACK_SPEED_MAX         16
+
+
+// One stored image. Offsets are relative to the start of the image pool.
+struct struct_gallery_entry_t {
+	Xuint32 uFormat;
+	Xuint32 uOffset;
+	Xuint32 uSize;
+	Xuint32 uClipId;      // 0 for single shots, otherwise the burst number
+	Xuint32 uTimestamp;   // Global timer at capture (low word)
+}; typedef struct struct_gallery_entry_t gallery_entry_t;
+
+// Gallery directory, stored at GALLERY_BASE_ADDR
+struct struct_gallery_t {
+	Xuint32 uMagic;
+	Xuint32 uNumImages;
+	Xuint32 uPoolUsed;    // End of the last entry in the pool, in bytes
+	Xuint32 uNumPacked;   // Entries [0, uNumPacked) have been compacted
+	Xuint32 uNextClipId;
+	gallery_entry_t entries[GALLERY_MAX_IMAGES];
+}; typedef struct struct_gallery_t gallery_t;
+
+// Results of a burst capture
+struct struct_gallery_burst_t {
+	Xuint32 uFirst;       // Index of the first burst image
+	Xuint32 uFrames;      // Frames stored
+	Xuint32 uDropped;     // Sensor frames missed between stored frames
+	Xuint32 uElapsedUs;   // First to last stored frame
+	Xuint32 uFpsX100;     // Achieved rate, in hundredths of a frame/sec
+}; typedef struct struct_gallery_burst_t gallery_burst_t;
+
+
+// Playback state. The MM2S side flips between frame stores 1 and 2: one is
+// on screen while the next image is decoded into the other.
+struct struct_playback_t {
+	u32 uBaseAddr;
+	u32 uDMACR;           // MM2S control register to restore on stop
+	Xuint16 *pStore[2];   // MM2S frame stores 1 and 2
+	int display;          // pStore[] index being scanned out
+	int shown;            // Image in the display store, -1 for none
+	int ready;            // Image prefetched into the spare store, -1 for none
+	int mode;
+	int index;            // Current play position
+	int first, last;      // Range being played
+	Xuint32 uPhase;       // Ticks accumulated toward the next advance, in speed units
+	Xuint32 uSpeedX4;
+	Xuint32 uTicks;       // Display frames seen
+	Xuint32 uMisses;      // Advances that had to decode on the spot
+}; typedef struct struct_playback_t playback_t;
+
+
+// Function prototypes (gallery.c)
+void gallery_init(void);
+int gallery_count(void);
+int gallery_capture(volatile Xuint16 *pSrc);
+int gallery_burst(camera_config_t *config, int nFrames, gallery_burst_t *pBurst);
+int gallery_compact_step(void);
+int gallery_load(int index, Xuint16 *pDst);
+Xuint32 gallery_clip_range(int index, int *pFirst, int *pLast);
+
+// Function prototypes (playback.c)
+void playback_init(playback_t *pb, camera_config_t *config);
+void playback_start(playback_t *pb, int mode, int index);
+void playback_step(playback_t *pb, int delta);
+void playback_set_speed(playback_t *pb, Xuint32 uSpeedX4);
+int playback_tick(playback_t *pb);
+void playback_stop(playback_t *pb);
+
+
+#endif // __GALLERY_H__
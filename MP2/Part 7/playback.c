@@ -0,0 +1,185 @@
+/*****************************************************************************
+ * playback.c - gallery playback engine. Paced by the MM2S frame count flag,
+ * so every tick is one displayed frame. The image due next is decoded ahead
+ * of time into the spare MM2S frame store, and showing it is just a park
+ * pointer flip written during vertical blanking.
+ *****************************************************************************/
+
+#include "gallery.h"
+
+
+// Wrap an image index into the range being played
+static int playback_wrap(playback_t *pb, int index)
+{
+	int len = pb->last - pb->first + 1;
+
+	return pb->first + (((index - pb->first) % len) + len) % len;
+}
+
+
+// The image that will be wanted after the next advance
+static int playback_next(playback_t *pb)
+{
+	int steps = 1;
+
+	if (pb->mode == PLAYBACK_CLIP) {
+		steps = (pb->uPhase + pb->uSpeedX4) / PLAYBACK_SPEED_NORMAL;
+		if (steps == 0) {
+			steps = 1;
+		}
+	}
+
+	return playback_wrap(pb, pb->index + steps);
+}
+
+
+// Poll the MM2S frame count flag (end of every displayed frame)
+static void playback_wait_frame(playback_t *pb)
+{
+	XTime tStart, tNow;
+
+	XTime_GetTime(&tStart);
+	while ((XAxiVdma_ReadReg(pb->uBaseAddr, XAXIVDMA_TX_OFFSET+XAXIVDMA_SR_OFFSET) & XAXIVDMA_IXR_FRMCNT_MASK) == 0) {
+		XTime_GetTime(&tNow);
+		if (tNow - tStart > COUNTS_PER_SECOND / 10) {
+			break;
+		}
+	}
+	XAxiVdma_WriteReg(pb->uBaseAddr, XAXIVDMA_TX_OFFSET+XAXIVDMA_SR_OFFSET, XAXIVDMA_IXR_FRMCNT_MASK);
+}
+
+
+// Scan out the spare store from the next frame start
+static void playback_flip(playback_t *pb)
+{
+	u32 uParkPtr;
+
+	pb->display ^= 1;
+	uParkPtr = XAxiVdma_ReadReg(pb->uBaseAddr, XAXIVDMA_PARKPTR_OFFSET);
+	uParkPtr = (uParkPtr & ~XAXIVDMA_PARKPTR_READREF_MASK) | (pb->display + 1);
+	XAxiVdma_WriteReg(pb->uBaseAddr, XAXIVDMA_PARKPTR_OFFSET, uParkPtr);
+}
+
+
+void playback_init(playback_t *pb, camera_config_t *config)
+{
+	pb->uBaseAddr = config->vdma_hdmi.BaseAddr;
+	pb->pStore[0] = (Xuint16 *)XAxiVdma_ReadReg(pb->uBaseAddr, XAXIVDMA_MM2S_ADDR_OFFSET+XAXIVDMA_START_ADDR_OFFSET+4);
+	pb->pStore[1] = (Xuint16 *)XAxiVdma_ReadReg(pb->uBaseAddr, XAXIVDMA_MM2S_ADDR_OFFSET+XAXIVDMA_START_ADDR_OFFSET+8);
+	pb->display = 0;
+	pb->shown = -1;
+	pb->ready = -1;
+	pb->mode = PLAYBACK_STILL;
+	pb->index = 0;
+	pb->first = 0;
+	pb->last = 0;
+	pb->uPhase = 0;
+	pb->uSpeedX4 = PLAYBACK_SPEED_NORMAL;
+	pb->uTicks = 0;
+	pb->uMisses = 0;
+	pb->uDMACR = XAxiVdma_ReadReg(pb->uBaseAddr, XAXIVDMA_TX_OFFSET+XAXIVDMA_CR_OFFSET);
+}
+
+
+// Begin playing from an image. Clips play the burst the image belongs to,
+// the other modes cover the whole gallery.
+void playback_start(playback_t *pb, int mode, int index)
+{
+	if (pb->shown < 0) {
+		// Raise the MM2S frame count flag at the end of every frame
+		XAxiVdma_WriteReg(pb->uBaseAddr, XAXIVDMA_TX_OFFSET+XAXIVDMA_CR_OFFSET,
+				(pb->uDMACR & ~XAXIVDMA_FRMCNT_MASK) | (1 << XAXIVDMA_FRMCNT_SHIFT));
+		XAxiVdma_WriteReg(pb->uBaseAddr, XAXIVDMA_TX_OFFSET+XAXIVDMA_SR_OFFSET, XAXIVDMA_IXR_FRMCNT_MASK);
+	}
+
+	pb->mode = mode;
+	if (mode == PLAYBACK_CLIP) {
+		gallery_clip_range(index, &pb->first, &pb->last);
+	}
+	else {
+		pb->first = 0;
+		pb->last = gallery_count() - 1;
+	}
+	pb->index = playback_wrap(pb, index);
+	pb->uPhase = 0;
+}
+
+
+void playback_step(playback_t *pb, int delta)
+{
+	pb->index = playback_wrap(pb, pb->index + delta);
+	pb->uPhase = 0;
+}
+
+
+void playback_set_speed(playback_t *pb, Xuint32 uSpeedX4)
+{
+	pb->uSpeedX4 = (uSpeedX4 < 1) ? 1 : (uSpeedX4 > PLAYBACK_SPEED_MAX) ? PLAYBACK_SPEED_MAX : uSpeedX4;
+}
+
+
+// Wait for the next displayed frame, advance the play position, put the
+// wanted image on screen and prefetch the one after it. Returns the image
+// being shown.
+int playback_tick(playback_t *pb)
+{
+	int late = 0;
+	int next;
+
+	playback_wait_frame(pb);
+	pb->uTicks++;
+
+	if (pb->mode == PLAYBACK_SLIDESHOW) {
+		pb->uPhase += pb->uSpeedX4;
+		if (pb->uPhase >= PLAYBACK_SLIDE_TICKS * PLAYBACK_SPEED_NORMAL) {
+			pb->uPhase = 0;
+			pb->index = playback_wrap(pb, pb->index + 1);
+		}
+	}
+	else if (pb->mode == PLAYBACK_CLIP) {
+		// Frames beyond the display rate are skipped rather than shown late
+		pb->uPhase += pb->uSpeedX4;
+		pb->index = playback_wrap(pb, pb->index + pb->uPhase / PLAYBACK_SPEED_NORMAL);
+		pb->uPhase %= PLAYBACK_SPEED_NORMAL;
+	}
+
+	if (pb->index != pb->shown) {
+		if (pb->ready != pb->index) {
+			// Prefetch missed. Decoding now pushes the flip past this blanking
+			// interval, so the old store stays on screen for one more frame.
+			gallery_load(pb->index, pb->pStore[pb->display ^ 1]);
+			pb->uMisses++;
+			late = 1;
+		}
+		playback_flip(pb);
+		pb->shown = pb->index;
+		pb->ready = -1;
+	}
+
+	// Decode ahead into the store that just went off screen
+	next = playback_next(pb);
+	if (!late && next != pb->shown && next != pb->ready) {
+		gallery_load(next, pb->pStore[pb->display ^ 1]);
+		pb->ready = next;
+	}
+
+	return pb->shown;
+}
+
+
+// Hand the display back to frame store 1 for the live modes
+void playback_stop(playback_t *pb)
+{
+	u32 uParkPtr;
+
+	uParkPtr = XAxiVdma_ReadReg(pb->uBaseAddr, XAXIVDMA_PARKPTR_OFFSET);
+	XAxiVdma_WriteReg(pb->uBaseAddr, XAXIVDMA_PARKPTR_OFFSET, (uParkPtr & ~XAXIVDMA_PARKPTR_READREF_MASK) | 0x1);
+	XAxiVdma_WriteReg(pb->uBaseAddr, XAXIVDMA_TX_OFFSET+XAXIVDMA_CR_OFFSET, pb->uDMACR);
+
+	xil_printf("Playback: %d frames, %d late decodes\n\r", pb->uTicks, pb->uMisses);
+	pb->display = 0;
+	pb->shown = -1;
+	pb->ready = -1;
+	pb->uTicks = 0;
+	pb->uMisses = 0;
+}
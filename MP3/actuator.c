@@ -0,0 +1,249 @@
+// actuator.c - drive the launcher from its own thread.
+//
+// The detector submits aim commands through a lock-free latest-command
+// mailbox and never waits on the launcher, even while the actuator thread
+// is stuck in a write(). A new command replaces one the actuator has not
+// taken yet, so it always executes the newest, dropping any that sat too
+// long (e.g. behind a fire sequence). Each axis of a move
+// runs until its own time ends or a newer command replaces it, so the
+// launcher follows the detector at frame rate instead of one blocking move
+// per frame.
+//
+// Replays on a host don't use this thread; scene_sim.c runs the same
+// command handling on the clip's clock instead.
+//
+// With tracing on, each write() to the launcher is a span, and each command
+// is followed by a flow arrow from its submission to its execution.
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include "sentry.h"
+
+static double act_now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+void launcher_cmd(int fd, int cmd) {
+  char byte = cmd;
+  int retval;
+
+  while ((retval = write(fd, &byte, 1)) != 1) {
+    if (retval < 0) {
+      fprintf(stderr, "Could not send command to %s (error %d)\n", LAUNCHER_NODE, retval);
+      return;
+    }
+    fprintf(stdout, "Command busy, waiting...\n");
+  }
+}
+
+const char *launcher_cmd_name(int cmd) {
+  switch (cmd) {
+    case LAUNCHER_FIRE:  return "FIRE";
+    case LAUNCHER_STOP:  return "STOP";
+    case LAUNCHER_UP:    return "UP";
+    case LAUNCHER_DOWN:  return "DOWN";
+    case LAUNCHER_LEFT:  return "LEFT";
+    case LAUNCHER_RIGHT: return "RIGHT";
+    case LAUNCHER_UP_LEFT:    return "UP_LEFT";
+    case LAUNCHER_DOWN_LEFT:  return "DOWN_LEFT";
+    case LAUNCHER_UP_RIGHT:   return "UP_RIGHT";
+    case LAUNCHER_DOWN_RIGHT: return "DOWN_RIGHT";
+  }
+  return "?";
+}
+
+const char *aim_type_name(aim_type_t type) {
+  switch (type) {
+    case AIM_STOP: return "stop";
+    case AIM_MOVE: return "move";
+    case AIM_FIRE: return "fire";
+  }
+  return "?";
+}
+
+static void actuator_send(actuator_t *a, int cmd) {
+  int64_t t = trace_now();
+
+  launcher_cmd(a->fd, cmd);
+  trace_span("write", t, "cmd", cmd);
+}
+
+static void aim_mailbox_init(aim_mailbox_t *m) {
+  m->back = 0;
+  m->front = 1;
+  atomic_init(&m->latest, 2);
+}
+
+// Producer side. Returns 0 if this replaced a command not yet taken.
+static int aim_mailbox_put(aim_mailbox_t *m, const aim_cmd_t *c) {
+  unsigned old;
+
+  m->slots[m->back] = *c;
+  old = atomic_exchange_explicit(&m->latest, m->back | AIM_SLOT_FRESH, memory_order_acq_rel);
+  m->back = old & ~AIM_SLOT_FRESH;
+  return !(old & AIM_SLOT_FRESH);
+}
+
+// Consumer side. Returns 0 if nothing new was published.
+static int aim_mailbox_take(aim_mailbox_t *m, aim_cmd_t *c) {
+  unsigned old;
+
+  if (!(atomic_load_explicit(&m->latest, memory_order_relaxed) & AIM_SLOT_FRESH)) {
+    return 0;
+  }
+  // Only the consumer clears AIM_SLOT_FRESH, so the slot taken is fresh
+  old = atomic_exchange_explicit(&m->latest, m->front, memory_order_acq_rel);
+  m->front = old & ~AIM_SLOT_FRESH;
+  *c = m->slots[m->front];
+  return 1;
+}
+
+// Take the newest command into the pending slot, replacing one not yet run
+static void actuator_drain(actuator_t *a) {
+  aim_cmd_t c;
+
+  if (aim_mailbox_take(&a->mailbox, &c)) {
+    if (a->has_pending) {
+      a->dropped++;
+    }
+    a->pending = c;
+    a->has_pending = 1;
+  }
+}
+
+// Sleep, still taking the newest command as it comes in
+static void actuator_sleep(actuator_t *a, int ms) {
+  double end = act_now_ms() + ms;
+  int64_t t = trace_now();
+
+  while (act_now_ms() < end) {
+    actuator_drain(a);
+    usleep(ACT_POLL_MS * 1000);
+  }
+  trace_span("sleep", t, "ms", ms);
+}
+
+// Run the given axes (0 to stop), sending only when that changes
+static void actuator_steer(actuator_t *a, int direction) {
+  if (direction == (a->moving ? a->direction : 0)) {
+    return;
+  }
+  actuator_send(a, direction ? direction : LAUNCHER_STOP);
+  a->moving = direction != 0;
+  a->direction = direction;
+}
+
+// Drop each axis whose run time is up
+static void actuator_expire(actuator_t *a) {
+  double now = act_now_ms();
+  int direction = a->moving ? a->direction : 0;
+
+  if (now >= a->pan_until) {
+    direction &= ~(LAUNCHER_LEFT | LAUNCHER_RIGHT);
+  }
+  if (now >= a->tilt_until) {
+    direction &= ~(LAUNCHER_UP | LAUNCHER_DOWN);
+  }
+  actuator_steer(a, direction);
+}
+
+static void actuator_fire(actuator_t *a) {
+  printf("Stop & Fire\n");
+  actuator_send(a, LAUNCHER_STOP);
+  actuator_send(a, LAUNCHER_UP);
+  actuator_sleep(a, ACT_FIRE_RAISE_MS);
+  actuator_send(a, LAUNCHER_STOP);
+  actuator_sleep(a, ACT_FIRE_SETTLE_MS);
+  actuator_send(a, LAUNCHER_FIRE);
+  actuator_sleep(a, ACT_FIRE_RELOAD_MS);
+  a->moving = 0;
+  a->fired++;
+}
+
+static void *actuator_main(void *arg) {
+  actuator_t *a = arg;
+  aim_cmd_t c;
+  double now;
+  int64_t t;
+
+  trace_thread_name("actuator");
+  while (!atomic_load(&a->quit)) {
+    actuator_drain(a);
+    if (!a->has_pending) {
+      actuator_expire(a);
+      usleep(ACT_POLL_MS * 1000);
+      continue;
+    }
+
+    c = a->pending;
+    a->has_pending = 0;
+    if (act_now_ms() - c.issued_ms > ACT_MAX_AGE_MS) {
+      a->stale++;
+      trace_mark("stale", "seq", c.seq);
+      continue;
+    }
+    a->executed++;
+    t = trace_now();
+    trace_flow("command", 0, c.seq);
+
+    switch (c.type) {
+      case AIM_STOP:
+        actuator_steer(a, 0);
+        break;
+      case AIM_MOVE:
+        // Keep going without a stop/start if the axes are unchanged
+        now = act_now_ms();
+        a->pan_until = now + c.pan_ms;
+        a->tilt_until = now + c.tilt_ms;
+        actuator_steer(a, c.direction);
+        break;
+      case AIM_FIRE:
+        actuator_fire(a);
+        break;
+    }
+    trace_span("execute", t, "type", c.type);
+  }
+
+  actuator_send(a, LAUNCHER_STOP);
+  return NULL;
+}
+
+int actuator_start(actuator_t *a, int fd) {
+  a->fd = fd;
+  aim_mailbox_init(&a->mailbox);
+  atomic_init(&a->quit, 0);
+  a->has_pending = 0;
+  a->moving = 0;
+  a->pan_until = a->tilt_until = 0;
+  a->submitted = a->executed = a->dropped = a->stale = a->replaced = a->fired = 0;
+  if (pthread_create(&a->thread, NULL, actuator_main, a) != 0) {
+    perror("pthread_create");
+    return -1;
+  }
+  return 0;
+}
+
+// Queue a command for the launcher. Never blocks.
+void actuator_submit(actuator_t *a, const aim_cmd_t *cmd) {
+  aim_cmd_t c = *cmd;
+  int64_t t = trace_now();
+
+  c.issued_ms = act_now_ms();
+  c.seq = a->submitted++;
+  trace_flow("command", 1, c.seq);
+  if (!aim_mailbox_put(&a->mailbox, &c)) {
+    a->replaced++;
+  }
+  trace_span("submit", t, "type", c.type);
+}
+
+void actuator_stop(actuator_t *a) {
+  atomic_store(&a->quit, 1);
+  pthread_join(a->thread, NULL);
+  printf("Actuator: %d commands, %d executed, %d superseded, %d stale, %d shots\n", a->submitted, a->executed,
+         a->dropped + a->replaced, a->stale, a->fired);
+}
@@ -0,0 +1,205 @@
+// aim_control.c - turn the target's offset from the frame center into
+// launcher motor time.
+//
+// The PID law runs one controller per axis on the pixel error. Its output is
+// the correction in pixels, which the motor model turns into milliseconds
+// (plus the spin-up lag when the axis is at rest). Commands are replaced
+// every frame, so each one only has to be right until the next frame
+// arrives; the integral takes up a motor that is slower than the model and
+// the derivative damps the approach. Inside the deadband an axis holds and
+// its integral is cleared, and a command longer than AIM_MAX_MOVE_MS is cut
+// short without winding the integral up further.
+//
+// Firing goes by a radial gate of AIM_FIRE_RADIUS, well inside the target,
+// rather than by the deadband. A target in the gate stops a launcher that
+// is still running, and the launcher fires once AIM_FIRE_FRAMES frames in a
+// row taken after that have the target in the gate; one frame alone may
+// still show the launcher coasting.
+//
+// The controller remembers what it has asked each axis to do, so the same
+// model also tells the tracker how far the launcher has turned the image
+// between two frames (aim_motion()).
+//
+// The step law is the original decision: move the axis with the larger
+// error for a time proportional to it, never less than DELAY_MIN. It is
+// kept for comparison in the closed-loop host test.
+
+#include <math.h>
+#include <stdlib.h>
+#include "sentry.h"
+
+#define DELAY_MIN                  50
+#define DELAY_MAX                  250
+#define MAX_DIST_X                 (DISP_WIDTH / 2 - AIM_DEADBAND_X)
+#define MAX_DIST_Y                 (DISP_HEIGHT / 2 - AIM_DEADBAND_Y)
+
+void aim_init(aim_ctrl_t *a, aim_law_t law) {
+  a->law = law;
+  aim_reset(a);
+}
+
+// Forget the history, e.g. when the target is lost
+void aim_reset(aim_ctrl_t *a) {
+  a->pan.integral = a->tilt.integral = 0;
+  a->pan.has_last = a->tilt.has_last = 0;
+  a->pan.sign = a->tilt.sign = 0;
+  a->pan.since = a->tilt.since = 0;
+  a->pan.run_until = a->tilt.run_until = 0;
+  a->last_ms = 0;
+  a->centered = 0;
+}
+
+const char *aim_law_name(aim_law_t law) {
+  switch (law) {
+    case AIM_LAW_STEP: return "step";
+    case AIM_LAW_PID:  return "pid";
+  }
+  return "?";
+}
+
+// Record a command for one axis: run towards sign for ms, or stop (ms 0)
+static void aim_axis_run(aim_axis_t *ax, int sign, int ms, double clock_ms) {
+  if (ms == 0) {
+    ax->sign = 0;
+    ax->run_until = clock_ms;
+    return;
+  }
+  if (sign != ax->sign || clock_ms >= ax->run_until) {
+    ax->since = clock_ms;
+  }
+  ax->sign = sign;
+  ax->run_until = clock_ms + ms;
+}
+
+// Image motion the commands to one axis cause between from_ms and to_ms
+static double aim_axis_motion(const aim_axis_t *ax, double from_ms, double to_ms, double px_per_ms) {
+  double start = ax->since + AIM_MOTOR_LAG_MS;
+  double end = ax->run_until;
+
+  start = (start > from_ms) ? start : from_ms;
+  end = (end < to_ms) ? end : to_ms;
+  return (ax->sign != 0 && end > start) ? ax->sign * (end - start) * px_per_ms : 0;
+}
+
+// How far, by the motor model, the launcher has moved the target in the
+// image between two frames (the target moves against the launcher)
+void aim_motion(const aim_ctrl_t *a, double from_ms, double to_ms, double *dx, double *dy) {
+  *dx = -aim_axis_motion(&a->pan, from_ms, to_ms, AIM_PAN_PX_PER_MS);
+  *dy = -aim_axis_motion(&a->tilt, from_ms, to_ms, AIM_TILT_PX_PER_MS);
+}
+
+// One axis of the PID law. Returns the motor time and sets *sign to the
+// direction (+1 towards positive error), or returns 0 to hold the axis.
+static int aim_axis(aim_axis_t *ax, double error, double dt, double px_per_ms, double deadband,
+                    double clock_ms, int *sign) {
+  double derivative = 0, u, ms;
+
+  if (fabs(error) <= deadband) {
+    ax->integral = 0;
+    ax->last_error = error;
+    ax->has_last = 1;
+    aim_axis_run(ax, 0, 0, clock_ms);
+    return 0;
+  }
+
+  if (ax->has_last && dt > 0) {
+    derivative = (error - ax->last_error) / dt;
+  }
+  ax->last_error = error;
+  ax->has_last = 1;
+  ax->integral += error * dt;
+  if (ax->integral > AIM_I_LIMIT) {
+    ax->integral = AIM_I_LIMIT;
+  } else if (ax->integral < -AIM_I_LIMIT) {
+    ax->integral = -AIM_I_LIMIT;
+  }
+
+  u = AIM_KP * error + AIM_KI * ax->integral + AIM_KD * derivative;
+  // Damping can ask for less than nothing: coast and let the next frame decide
+  if (u * error <= 0) {
+    aim_axis_run(ax, 0, 0, clock_ms);
+    return 0;
+  }
+
+  *sign = (u > 0) ? 1 : -1;
+  ms = fabs(u) / px_per_ms;
+  if (ax->sign != *sign || clock_ms >= ax->run_until) {
+    ms += AIM_MOTOR_LAG_MS;
+  }
+  if (ms > AIM_MAX_MOVE_MS) {
+    ms = AIM_MAX_MOVE_MS;
+    ax->integral -= error * dt;
+  }
+
+  aim_axis_run(ax, *sign, (int)ms, clock_ms);
+  return (int)ms;
+}
+
+static aim_cmd_t aim_step(aim_ctrl_t *a, double err_x, double err_y, double clock_ms) {
+  aim_cmd_t c = {.type = AIM_MOVE};
+  int ms;
+
+  if (err_x * err_x > err_y * err_y) {
+    ms = (int)(fabs(err_x) / MAX_DIST_X * DELAY_MAX);
+    c.direction = (err_x > 0) ? LAUNCHER_RIGHT : LAUNCHER_LEFT;
+    c.pan_ms = (ms > DELAY_MIN) ? ms : DELAY_MIN;
+  } else {
+    ms = (int)(fabs(err_y) / MAX_DIST_Y * DELAY_MAX);
+    c.direction = (err_y > 0) ? LAUNCHER_DOWN : LAUNCHER_UP;
+    c.tilt_ms = (ms > DELAY_MIN) ? ms : DELAY_MIN;
+  }
+  aim_axis_run(&a->pan, (err_x > 0) ? 1 : -1, c.pan_ms, clock_ms);
+  aim_axis_run(&a->tilt, (err_y > 0) ? 1 : -1, c.tilt_ms, clock_ms);
+  return c;
+}
+
+// Whether a target this far from the frame center is close enough to fire at
+int aim_in_gate(double x, double y) {
+  return x * x + y * y < AIM_FIRE_RADIUS * AIM_FIRE_RADIUS;
+}
+
+// now_x and now_y are the target's offset from the frame center (positive
+// right and down) at the frame's time clock_ms, err_x and err_y where it is
+// expected to be by the time the launcher responds. The launcher is steered
+// by the latter but fires on the former.
+aim_cmd_t aim_update(aim_ctrl_t *a, double now_x, double now_y, double err_x, double err_y, double clock_ms) {
+  aim_cmd_t c = {.type = AIM_MOVE};
+  double dt = (a->last_ms > 0) ? (clock_ms - a->last_ms) * 1e-3 : 0;
+  int sign = 0;
+
+  a->last_ms = clock_ms;
+  if (aim_in_gate(now_x, now_y)) {
+    // Only fire from frames taken with the launcher standing still
+    if (clock_ms < a->pan.run_until || clock_ms < a->tilt.run_until) {
+      aim_axis_run(&a->pan, 0, 0, clock_ms);
+      aim_axis_run(&a->tilt, 0, 0, clock_ms);
+      a->centered = 0;
+      c.type = AIM_STOP;
+      return c;
+    }
+    if (++a->centered < AIM_FIRE_FRAMES) {
+      c.type = AIM_STOP;
+      return c;
+    }
+    aim_reset(a);
+    c.type = AIM_FIRE;
+    return c;
+  }
+  a->centered = 0;
+  if (a->law == AIM_LAW_STEP) {
+    return aim_step(a, err_x, err_y, clock_ms);
+  }
+
+  c.pan_ms = aim_axis(&a->pan, err_x, dt, AIM_PAN_PX_PER_MS, AIM_DEADBAND_X, clock_ms, &sign);
+  if (c.pan_ms > 0) {
+    c.direction |= (sign > 0) ? LAUNCHER_RIGHT : LAUNCHER_LEFT;
+  }
+  c.tilt_ms = aim_axis(&a->tilt, err_y, dt, AIM_TILT_PX_PER_MS, AIM_DEADBAND_Y, clock_ms, &sign);
+  if (c.tilt_ms > 0) {
+    c.direction |= (sign > 0) ? LAUNCHER_DOWN : LAUNCHER_UP;
+  }
+  if (c.direction == 0) {
+    c.type = AIM_STOP;
+  }
+  return c;
+}
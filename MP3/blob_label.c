@@ -0,0 +1,264 @@
+// blob_label.c - single-pass connected-component labeling on runs.
+//
+// The scan hands over each horizontal run of target pixels, row by row and
+// left to right within a row. A run takes the label of every run it touches
+// in the row above (8-connected), merging their labels with union-find, so
+// area, bounding box and coordinate sums are complete once no run in the
+// latest row belongs to the blob. Only two rows of runs are kept, and the
+// labels of finished blobs and merged-away labels are recycled, so noisy
+// frames don't run out of labels.
+//
+// Each blob also collects the sums of x^2, y^2 and xy over its pixels. They
+// are added per run in closed form, so the shape costs nothing per pixel.
+// A finished blob whose shape fails the gate is counted and dropped.
+
+#include <math.h>
+#include <string.h>
+#include "sentry.h"
+
+// Sum of k^2 for k = 0..n
+static int64_t sum_sq(int64_t n) {
+  return n * (n + 1) * (2 * n + 1) / 6;
+}
+
+void blob_begin(labeler_t *l) {
+  l->row = -2;
+  l->prev = l->runs[0];
+  l->cur = l->runs[1];
+  l->nprev = 0;
+  l->ncur = 0;
+  l->next = 0;
+  l->nlabels = 0;
+  l->nfree = 0;
+  l->ntop = 0;
+  l->components = 0;
+  l->rejected = 0;
+  l->overflow = 0;
+}
+
+void blob_set_gate(labeler_t *l, const shape_gate_t *gate) {
+  l->gate = *gate;
+}
+
+// Central second moments give the equivalent ellipse: its axes are the
+// eigenvectors of the covariance [mu20 mu11; mu11 mu02].
+void blob_shape(const blob_t *b, blob_shape_t *s) {
+  double n = b->area;
+  double mu20, mu02, mu11, half_sum, root;
+
+  s->cx = b->x_sum / n;
+  s->cy = b->y_sum / n;
+  mu20 = b->xx_sum / n - s->cx * s->cx;
+  mu02 = b->yy_sum / n - s->cy * s->cy;
+  mu11 = b->xy_sum / n - s->cx * s->cy;
+  half_sum = (mu20 + mu02) / 2;
+  root = sqrt((mu20 - mu02) * (mu20 - mu02) / 4 + mu11 * mu11);
+
+  s->orientation = 0.5 * atan2(2 * mu11, mu20 - mu02);
+  s->major = sqrt(half_sum + root);
+  s->minor = sqrt(half_sum - root > 0 ? half_sum - root : 0);
+  s->eccentricity = (s->major > 0) ? sqrt(1 - (s->minor * s->minor) / (s->major * s->major)) : 0;
+  s->fill = n / ((double)(b->x_max - b->x_min + 1) * (b->y_max - b->y_min + 1));
+}
+
+int blob_shape_ok(const blob_t *b, const shape_gate_t *gate) {
+  blob_shape_t s;
+
+  if (b->area < gate->min_area || (gate->max_area > 0 && b->area > gate->max_area)) {
+    return 0;
+  }
+  if (gate->min_fill <= 0 && gate->max_eccentricity <= 0) {
+    return 1;
+  }
+  blob_shape(b, &s);
+  return s.fill >= gate->min_fill && (gate->max_eccentricity <= 0 || s.eccentricity <= gate->max_eccentricity);
+}
+
+static int blob_find(labeler_t *l, int a) {
+  while (l->parent[a] != a) {
+    l->parent[a] = l->parent[l->parent[a]];   // Path halving
+    a = l->parent[a];
+  }
+  return a;
+}
+
+// Merge two roots, keeping the older label, and return the survivor
+static int blob_union(labeler_t *l, int a, int b) {
+  blob_t *keep, *gone;
+
+  b = blob_find(l, b);
+  if (a == b) {
+    return a;
+  }
+  if (b < a) {
+    int t = a;
+    a = b;
+    b = t;
+  }
+  keep = &l->stats[a];
+  gone = &l->stats[b];
+  keep->area += gone->area;
+  keep->x_sum += gone->x_sum;
+  keep->y_sum += gone->y_sum;
+  keep->xx_sum += gone->xx_sum;
+  keep->yy_sum += gone->yy_sum;
+  keep->xy_sum += gone->xy_sum;
+  if (gone->x_min < keep->x_min) keep->x_min = gone->x_min;
+  if (gone->x_max > keep->x_max) keep->x_max = gone->x_max;
+  if (gone->y_min < keep->y_min) keep->y_min = gone->y_min;
+  l->parent[b] = a;
+  return a;
+}
+
+static int blob_alloc(labeler_t *l) {
+  if (l->nfree > 0) {
+    return l->free[--l->nfree];
+  }
+  if (l->nlabels < BLOB_MAX_LABELS) {
+    return l->nlabels++;
+  }
+  return -1;
+}
+
+static void blob_release(labeler_t *l, int label, uint32_t done) {
+  l->stamp[label] = done;
+  l->free[l->nfree++] = label;
+}
+
+// A finished blob goes into the short list of the largest ones
+static void blob_emit(labeler_t *l, const blob_t *b) {
+  int j;
+
+  l->components++;
+  if (!blob_shape_ok(b, &l->gate)) {
+    l->rejected++;
+    return;
+  }
+  if (l->ntop == BLOB_MAX && b->area <= l->top[BLOB_MAX - 1].area) {
+    return;
+  }
+  j = (l->ntop < BLOB_MAX) ? l->ntop++ : BLOB_MAX - 1;
+  while (j > 0 && l->top[j - 1].area < b->area) {
+    l->top[j] = l->top[j - 1];
+    j--;
+  }
+  l->top[j] = *b;
+}
+
+// Called when the scan moves past a row. Blobs reached by the runs of the
+// finished row stay live. Every other blob referenced by the discarded row
+// is complete, and labels that are no longer roots are garbage. With
+// finished set to 0 everything is discarded.
+static void blob_retire(labeler_t *l, int finished) {
+  uint32_t live, done;
+  int k, label, root;
+
+  l->epoch++;
+  live = 2 * l->epoch;
+  done = live + 1;
+
+  for (k = 0; finished && k < l->ncur; k++) {
+    if (l->cur[k].label >= 0) {
+      l->stamp[blob_find(l, l->cur[k].label)] = live;
+    }
+  }
+  for (k = 0; k < l->nprev + (finished ? 0 : l->ncur); k++) {
+    label = (k < l->nprev) ? l->prev[k].label : l->cur[k - l->nprev].label;
+    if (label < 0) {
+      continue;
+    }
+    root = blob_find(l, label);
+    if (label != root && l->stamp[label] != done) {
+      blob_release(l, label, done);
+    }
+    if (l->stamp[root] != live && l->stamp[root] != done) {
+      blob_emit(l, &l->stats[root]);
+      blob_release(l, root, done);
+    }
+  }
+  for (k = 0; finished && k < l->ncur; k++) {
+    label = l->cur[k].label;
+    if (label < 0) {
+      continue;
+    }
+    root = blob_find(l, label);
+    if (label != root && l->stamp[label] != done) {
+      blob_release(l, label, done);
+    }
+    l->cur[k].label = root;
+  }
+}
+
+void blob_add_run(labeler_t *l, int row, int start, int end) {
+  int label = -1;
+  int len = end - start + 1;
+  int64_t x_sum;
+  int k;
+  blob_t *b;
+
+  if (row != l->row) {
+    // The finished row becomes the row above, unless rows were skipped
+    blob_run_t *t = l->prev;
+    int adjacent = (row == l->row + 1);
+
+    blob_retire(l, adjacent);
+    l->prev = l->cur;
+    l->cur = t;
+    l->nprev = adjacent ? l->ncur : 0;
+    l->ncur = 0;
+    l->next = 0;
+    l->row = row;
+  }
+
+  // Runs above that end left of this one can't touch any later run either
+  while (l->next < l->nprev && l->prev[l->next].end < start - 1) {
+    l->next++;
+  }
+  for (k = l->next; k < l->nprev && l->prev[k].start <= end + 1; k++) {
+    if (l->prev[k].label < 0) {
+      continue;
+    }
+    label = (label < 0) ? blob_find(l, l->prev[k].label) : blob_union(l, label, l->prev[k].label);
+  }
+
+  if (label < 0) {
+    label = blob_alloc(l);
+    if (label < 0) {
+      l->overflow += len;
+      l->cur[l->ncur++] = (blob_run_t){start, end, -1};
+      return;
+    }
+    l->parent[label] = label;
+    b = &l->stats[label];
+    memset(b, 0, sizeof(*b));
+    b->x_min = start;
+    b->x_max = end;
+    b->y_min = row;
+  }
+
+  b = &l->stats[label];
+  x_sum = (int64_t)(start + end) * len / 2;
+  b->area += len;
+  b->x_sum += x_sum;
+  b->y_sum += (int64_t)row * len;
+  b->xx_sum += sum_sq(end) - sum_sq(start - 1);
+  b->yy_sum += (int64_t)row * row * len;
+  b->xy_sum += row * x_sum;
+  if (start < b->x_min) b->x_min = start;
+  if (end > b->x_max) b->x_max = end;
+  b->y_max = row;
+  l->cur[l->ncur++] = (blob_run_t){start, end, label};
+}
+
+// Finish the frame and copy out the largest blobs, biggest first. Returns
+// how many were copied.
+int blob_end(labeler_t *l, blob_t *blobs, int max) {
+  blob_retire(l, 0);
+  l->nprev = 0;
+  l->ncur = 0;
+  if (max > l->ntop) {
+    max = l->ntop;
+  }
+  memcpy(blobs, l->top, max * sizeof(blob_t));
+  return max;
+}
@@ -0,0 +1,241 @@
+// camshift.c - follow a locked target by its colors (CamShift).
+//
+// At lock-on the Cb/Cr histogram of the target's box is compared with that
+// of a ring of background around it, which gives for every chroma cell the
+// probability that a pixel of that color belongs to the target. Each frame
+// that table is back-projected over the search window only, and mean shift
+// moves the window to the centroid of the weights until it settles. The
+// moments of the final window give the target's size and orientation, and
+// the next frame's window is sized from them. The cost follows the window,
+// not the frame, and the target doesn't have to fit a fixed color box.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sentry.h"
+
+#define CAMSHIFT_VERIFY_WINDOWS    1000
+
+// Chroma cell of a pixel pair, as in the LUT classifier
+static inline int camshift_bin(int cb, int cr) {
+  return (cb >> 3) << 5 | (cr >> 3);
+}
+
+// The pixels of w, clipped to the frame in whole pairs
+static pix422_view_t camshift_view(const uint32_t *frame, const scan_window_t *w) {
+  pix422_view_t f = pix422_view(frame, DISP_WIDTH, DISP_HEIGHT, FRAME_WORDS_PER_ROW);
+
+  return pix422_window(&f, w->x0, w->y0, w->x1, w->y1);
+}
+
+// Build the model from the target's box in frame. Returns -1 if the box
+// holds no usable color.
+int camshift_lock(camshift_t *cs, const uint32_t *frame, const scan_window_t *box) {
+  static uint32_t in[CAMSHIFT_BINS], ring[CAMSHIFT_BINS];
+  scan_window_t around = {box->x0 - CAMSHIFT_RING, box->y0 - CAMSHIFT_RING,
+                          box->x1 + CAMSHIFT_RING, box->y1 + CAMSHIFT_RING};
+  pix422_view_t inner = camshift_view(frame, box);
+  pix422_view_t outer = camshift_view(frame, &around);
+  pix422_iter_t it = pix422_begin(&outer);
+  pix422_pair_t p;
+  double n_in = 0, n_ring = 0;
+
+  memset(in, 0, sizeof(in));
+  memset(ring, 0, sizeof(ring));
+  while (pix422_next(&it, &p)) {
+    int x = outer.x0 + it.x, y = outer.y0 + it.y;
+    int n = (p.y0 >= CAMSHIFT_MIN_Y) + (p.y1 >= CAMSHIFT_MIN_Y);
+
+    if (y >= inner.y0 && y < inner.y0 + inner.height && x >= inner.x0 && x < inner.x0 + inner.width) {
+      in[camshift_bin(p.cb, p.cr)] += n;
+      n_in += n;
+    } else {
+      ring[camshift_bin(p.cb, p.cr)] += n;
+      n_ring += n;
+    }
+  }
+  if (n_in == 0) {
+    return -1;
+  }
+
+  // P(target | cell), with the ring scaled to the box's pixel count. The
+  // box's corners hold background too, so cells that are more likely
+  // background than target are left out: weighted in, the background
+  // around the target would pull the window ever wider.
+  for (int i = 0; i < CAMSHIFT_BINS; i++) {
+    double bg = (n_ring > 0) ? ring[i] * n_in / n_ring : 0;
+    int p = (in[i] > 0) ? (int)(255 * in[i] / (in[i] + bg) + 0.5) : 0;
+
+    cs->model[i] = (p >= CAMSHIFT_MIN_P) ? p : 0;
+  }
+  cs->active = 1;
+  cs->mass0 = 0;
+  cs->cx = inner.x0 + inner.width / 2.0;
+  cs->cy = inner.y0 + inner.height / 2.0;
+  cs->half_w = inner.width / 2.0 * CAMSHIFT_GROW;
+  cs->half_h = inner.height / 2.0 * CAMSHIFT_GROW;
+  cs->orientation = 0;
+  cs->iterations = 0;
+  return 0;
+}
+
+// Weighted moments of the back-projection over v, with the weight of a
+// pixel being the model's 0..255 for its chroma
+static double camshift_moments(const camshift_t *cs, const pix422_view_t *v, double m[6]) {
+  memset(m, 0, 6 * sizeof(double));
+  for (int r = 0; r < v->height; r++) {
+    const uint32_t *src = pix422_row(v, r);
+    int row = v->y0 + r;
+    uint32_t s0 = 0, s1 = 0;
+    uint64_t sx = 0, sxx = 0;
+
+    for (int i = 0; i < v->width / 2; i++) {
+      uint32_t word = src[i];
+      uint32_t p = cs->model[camshift_bin(pix422_cb(word), pix422_cr(word))];
+      uint32_t p0 = (pix422_y0(word) >= CAMSHIFT_MIN_Y) ? p : 0;
+      uint32_t p1 = (pix422_y1(word) >= CAMSHIFT_MIN_Y) ? p : 0;
+      uint32_t dx = 2 * i;
+
+      s0 += p0 + p1;
+      s1 += p1;
+      sx += (p0 + p1) * dx;
+      sxx += (uint64_t)(p0 + p1) * dx * dx + p1 * (2 * dx + 1);
+    }
+    // Columns are relative to the view so the row sums stay integers; the
+    // odd pixel's +1 is added through s1
+    sx += s1;
+    m[0] += s0;
+    m[1] += sx + (double)s0 * v->x0;
+    m[2] += (double)s0 * row;
+    m[3] += sxx + 2.0 * v->x0 * sx + (double)v->x0 * v->x0 * s0;
+    m[4] += (double)s0 * row * row;
+    m[5] += (sx + (double)s0 * v->x0) * row;
+  }
+  return m[0];
+}
+
+// Find the target near (x, y) without leaving limit. On success fills b as
+// a detection for the tracker and returns 1; returns 0 and drops the lock
+// once too little of the target's color is left.
+int camshift_track(camshift_t *cs, const uint32_t *frame, const scan_window_t *limit, double x, double y,
+                   blob_t *b) {
+  scan_window_t w;
+  pix422_view_t v;
+  double m[6], mass = 0, mu20, mu02, mu11, sx, sy;
+  int it;
+
+  cs->cx = x;
+  cs->cy = y;
+  for (it = 0; it < CAMSHIFT_MAX_ITER; it++) {
+    double nx, ny;
+
+    w = (scan_window_t){(int)(cs->cx - cs->half_w), (int)(cs->cy - cs->half_h),
+                        (int)(cs->cx + cs->half_w) + 1, (int)(cs->cy + cs->half_h) + 1};
+    w.x0 = (w.x0 < limit->x0) ? limit->x0 : w.x0;
+    w.y0 = (w.y0 < limit->y0) ? limit->y0 : w.y0;
+    w.x1 = (w.x1 > limit->x1) ? limit->x1 : w.x1;
+    w.y1 = (w.y1 > limit->y1) ? limit->y1 : w.y1;
+    v = camshift_view(frame, &w);
+    if (v.width == 0 || v.height == 0) {
+      break;
+    }
+    mass = camshift_moments(cs, &v, m);
+    if (mass == 0) {
+      break;
+    }
+    nx = m[1] / mass;
+    ny = m[2] / mass;
+    if (fabs(nx - cs->cx) + fabs(ny - cs->cy) < CAMSHIFT_EPSILON) {
+      cs->cx = nx;
+      cs->cy = ny;
+      it++;
+      break;
+    }
+    cs->cx = nx;
+    cs->cy = ny;
+  }
+  cs->iterations = it;
+
+  // Mass in pixels: the model's certainty times the pixel count
+  mass /= 255;
+  if (cs->mass0 == 0) {
+    cs->mass0 = mass;
+  }
+  if (mass < BLOB_MIN_AREA || mass < CAMSHIFT_MIN_MASS * cs->mass0) {
+    cs->active = 0;
+    return 0;
+  }
+
+  mu20 = m[3] / m[0] - cs->cx * cs->cx;
+  mu02 = m[4] / m[0] - cs->cy * cs->cy;
+  mu11 = m[5] / m[0] - cs->cx * cs->cy;
+  sx = sqrt(mu20 > 0 ? mu20 : 0);
+  sy = sqrt(mu02 > 0 ? mu02 : 0);
+  cs->orientation = 0.5 * atan2(2 * mu11, mu20 - mu02);
+  // Two standard deviations reach the edge of a disc or square
+  cs->half_w = 2 * sx * CAMSHIFT_GROW;
+  cs->half_h = 2 * sy * CAMSHIFT_GROW;
+  cs->half_w = (cs->half_w < CAMSHIFT_MIN_HALF) ? CAMSHIFT_MIN_HALF : cs->half_w;
+  cs->half_h = (cs->half_h < CAMSHIFT_MIN_HALF) ? CAMSHIFT_MIN_HALF : cs->half_h;
+
+  memset(b, 0, sizeof(*b));
+  b->area = (int)(mass + 0.5);
+  b->x_min = (int)(cs->cx - 2 * sx);
+  b->x_max = (int)(cs->cx + 2 * sx);
+  b->y_min = (int)(cs->cy - 2 * sy);
+  b->y_max = (int)(cs->cy + 2 * sy);
+  b->x_sum = (int64_t)(cs->cx * b->area);
+  b->y_sum = (int64_t)(cs->cy * b->area);
+  b->xx_sum = (int64_t)((mu20 + cs->cx * cs->cx) * b->area);
+  b->yy_sum = (int64_t)((mu02 + cs->cy * cs->cy) * b->area);
+  b->xy_sum = (int64_t)((mu11 + cs->cx * cs->cy) * b->area);
+  return 1;
+}
+
+// Check the moments over random windows of random bytes against a sum over
+// each pixel, clipped by hand. Returns the number of mismatches.
+long camshift_verify(void) {
+  static uint32_t frame[FRAME_WORDS_PER_ROW * DISP_HEIGHT];
+  static camshift_t cs;
+  pix422_view_t f = pix422_view(frame, DISP_WIDTH, DISP_HEIGHT, FRAME_WORDS_PER_ROW);
+  long errors = 0;
+
+  srand(45);
+  for (int i = 0; i < FRAME_WORDS_PER_ROW * DISP_HEIGHT; i++) {
+    frame[i] = (uint32_t)rand() << 16 ^ (uint32_t)rand();
+  }
+  for (int i = 0; i < CAMSHIFT_BINS; i++) {
+    cs.model[i] = (rand() % 3) ? rand() % 256 : 0;
+  }
+
+  for (int k = 0; k < CAMSHIFT_VERIFY_WINDOWS; k++) {
+    // Partly off the frame, at odd columns, now and then
+    int x0 = rand() % (DISP_WIDTH + 200) - 100, y0 = rand() % (DISP_HEIGHT + 200) - 100;
+    scan_window_t w = {x0, y0, x0 + rand() % 120, y0 + rand() % 120};
+    pix422_view_t v = camshift_view(frame, &w);
+    int cx0 = (w.x0 < 0) ? 0 : w.x0 & ~1, cy0 = (w.y0 < 0) ? 0 : w.y0;
+    int cx1 = (w.x1 > DISP_WIDTH) ? DISP_WIDTH : (w.x1 + 1) & ~1, cy1 = (w.y1 > DISP_HEIGHT) ? DISP_HEIGHT : w.y1;
+    double m[6], ref[6] = {0};
+
+    camshift_moments(&cs, &v, m);
+    for (int y = cy0; y < cy1; y++) {
+      for (int x = cx0; x < cx1; x++) {
+        uint32_t word = pix422_word_at(&f, x, y);
+        double p = (pix422_y_at(&f, x, y) >= CAMSHIFT_MIN_Y) ? cs.model[camshift_bin(pix422_cb(word), pix422_cr(word))] : 0;
+
+        ref[0] += p;
+        ref[1] += p * x;
+        ref[2] += p * y;
+        ref[3] += p * x * x;
+        ref[4] += p * y * y;
+        ref[5] += p * x * y;
+      }
+    }
+    for (int i = 0; i < 6; i++) {
+      errors += (m[i] != ref[i]);
+    }
+  }
+  printf("Verified CamShift moments over %d windows: %ld mismatches\n", CAMSHIFT_VERIFY_WINDOWS, errors);
+  return errors;
+}
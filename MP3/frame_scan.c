@@ -0,0 +1,411 @@
+// frame_scan.c - find the target pixels in a frame and sum their positions.
+//
+// The full scan classifies every word. The coarse scan first classifies a
+// sparse grid of samples into a summed-area table of hits, refines the tiles
+// whose 3x3 neighbourhood holds enough of them, then classifies only those
+// tiles at full resolution. Targets much larger than the sample spacing give
+// the same sums as the full scan. The same table gives the densest 3x3 tiles
+// of the frame for free.
+// The window scan classifies only a rectangle, for when a target is locked.
+//
+// All scans feed the hits to the blob labeler as runs, in row order.
+//
+// All scans can be split across a persistent pool of threads, each owning a
+// band of rows. A worker keeps its own count and coordinate sums and writes
+// the runs it finds into a per-row table, then the calling thread merges the
+// sums and labels the runs in row order. The coarse scan does this twice:
+// the sample grid by bands of grid rows, then the refined tiles by bands of
+// tile rows. The time spent in banded work is counted, so the benchmark can
+// tell it from the serial merge around it.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sentry.h"
+
+typedef struct {
+  int16_t start, end;
+} scan_run_t;
+
+// Per-thread accumulators, a cache line each so workers don't share lines
+typedef struct {
+  int count;
+  int64_t x_sum;
+  int64_t y_sum;
+} __attribute__((aligned(64))) scan_part_t;
+
+static struct {
+  int nthreads;                 // Including the calling thread
+  pthread_t threads[SCAN_MAX_THREADS];
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  unsigned generation;          // Bumped for every job
+  int pending;                  // Workers still busy with the job
+  int quit;
+
+  // The job: job(index) does band index of nthreads
+  void (*job)(int index);
+  const classifier_t *c;
+  const uint32_t *frame;
+  scan_window_t window;
+  scan_part_t part[SCAN_MAX_THREADS];
+} scan_pool = {
+  .nthreads = 1,
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .start = PTHREAD_COND_INITIALIZER,
+  .done = PTHREAD_COND_INITIALIZER,
+};
+
+static double scan_banded_ms;   // Wall time in scan_pool_run
+static scan_run_t scan_runs[DISP_HEIGHT][DISP_WIDTH / 2 + 1];   // Runs of each row
+static int scan_nruns[DISP_HEIGHT];
+static uint8_t scan_hits[SCAN_GRID_ROWS][SCAN_GRID_COLS];      // Coarse samples
+static uint8_t scan_refine[SCAN_TILES_Y][SCAN_TILES_X];        // Tiles to classify
+static labeler_t scan_labeler;
+static int scan_density = SCAN_MIN_DENSITY;
+
+// Find the runs of hits in mask[0..npix), x0 being the column of mask[0].
+// Empty stretches are skipped eight bytes at a time. Adds the hits to the
+// sums and returns the number of runs.
+static int scan_runs_in(const uint8_t *mask, int npix, int x0, int row, scan_run_t *runs, scan_part_t *p) {
+  int n = 0;
+  int cnt = 0;
+  int64_t x_sum = 0;
+  int col = 0;
+
+  while (col < npix) {
+    uint64_t chunk;
+    int start;
+
+    while (col + 8 <= npix) {
+      memcpy(&chunk, mask + col, 8);
+      if (chunk) {
+        break;
+      }
+      col += 8;
+    }
+    while (col < npix && !mask[col]) {
+      col++;
+    }
+    if (col == npix) {
+      break;
+    }
+    start = col;
+    while (col < npix && mask[col]) {
+      col++;
+    }
+    cnt += col - start;
+    x_sum += (int64_t)(2 * x0 + start + col - 1) * (col - start) / 2;
+    runs[n].start = x0 + start;
+    runs[n++].end = x0 + col - 1;
+  }
+  p->count += cnt;
+  p->x_sum += x_sum;
+  p->y_sum += (int64_t)cnt * row;
+  return n;
+}
+
+// Single-threaded: find the runs and label them straight away
+static void scan_accumulate(scan_result_t *r, const uint8_t *mask, int npix, int x0, int row) {
+  scan_run_t runs[DISP_WIDTH / 2 + 1];
+  scan_part_t p = {0};
+  int n = scan_runs_in(mask, npix, x0, row, runs, &p);
+
+  for (int i = 0; i < n; i++) {
+    blob_add_run(&scan_labeler, row, runs[i].start, runs[i].end);
+  }
+  r->count += p.count;
+  r->x_sum += p.x_sum;
+  r->y_sum += p.y_sum;
+}
+
+// Classify band 'index' of the pool's window into the run table
+static void scan_rect_band(int index) {
+  const scan_window_t *w = &scan_pool.window;
+  int rows = w->y1 - w->y0;
+  int y0 = w->y0 + rows * index / scan_pool.nthreads;
+  int y1 = w->y0 + rows * (index + 1) / scan_pool.nthreads;
+  int npix = w->x1 - w->x0;
+  scan_part_t *p = &scan_pool.part[index];
+  uint8_t mask[DISP_WIDTH];
+
+  memset(p, 0, sizeof(*p));
+  for (int row = y0; row < y1; row++) {
+    scan_pool.c->classify_row(scan_pool.c, &scan_pool.frame[row * FRAME_WORDS_PER_ROW + w->x0 / 2], npix / 2, mask);
+    scan_nruns[row] = scan_runs_in(mask, npix, w->x0, row, scan_runs[row], p);
+  }
+}
+
+static void *scan_worker(void *arg) {
+  int index = (int)(intptr_t)arg;
+  unsigned seen = 0;
+  int64_t t;
+
+  trace_thread_name("scan worker");
+  pthread_mutex_lock(&scan_pool.lock);
+  for (;;) {
+    while (scan_pool.generation == seen && !scan_pool.quit) {
+      pthread_cond_wait(&scan_pool.start, &scan_pool.lock);
+    }
+    if (scan_pool.quit) {
+      break;
+    }
+    seen = scan_pool.generation;
+    pthread_mutex_unlock(&scan_pool.lock);
+
+    t = trace_now();
+    scan_pool.job(index);
+    trace_span("band", t, "band", index);
+
+    pthread_mutex_lock(&scan_pool.lock);
+    if (--scan_pool.pending == 0) {
+      pthread_cond_signal(&scan_pool.done);
+    }
+  }
+  pthread_mutex_unlock(&scan_pool.lock);
+  return NULL;
+}
+
+// Start the worker threads; the calling thread scans band 0 itself.
+// Returns the number of threads scanning, 1 if none could be started.
+int scan_threads_start(int nthreads) {
+  scan_threads_stop();
+  if (nthreads > SCAN_MAX_THREADS) {
+    nthreads = SCAN_MAX_THREADS;
+  }
+
+  scan_pool.quit = 0;
+  scan_pool.generation = 0;
+  for (scan_pool.nthreads = 1; scan_pool.nthreads < nthreads; scan_pool.nthreads++) {
+    if (pthread_create(&scan_pool.threads[scan_pool.nthreads], NULL, scan_worker,
+                       (void *)(intptr_t)scan_pool.nthreads) != 0) {
+      perror("pthread_create");
+      break;
+    }
+  }
+  return scan_pool.nthreads;
+}
+
+void scan_threads_stop(void) {
+  pthread_mutex_lock(&scan_pool.lock);
+  scan_pool.quit = 1;
+  pthread_cond_broadcast(&scan_pool.start);
+  pthread_mutex_unlock(&scan_pool.lock);
+  for (int i = 1; i < scan_pool.nthreads; i++) {
+    pthread_join(scan_pool.threads[i], NULL);
+  }
+  scan_pool.nthreads = 1;
+}
+
+static double scan_now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+// Milliseconds of banded work since the last call
+double scan_banded_time(void) {
+  double ms = scan_banded_ms;
+
+  scan_banded_ms = 0;
+  return ms;
+}
+
+// Run job on every band, band 0 on the calling thread, and wait for all of
+// them
+static void scan_pool_run(void (*job)(int index)) {
+  double t = scan_now_ms();
+
+  if (scan_pool.nthreads == 1) {
+    job(0);
+    scan_banded_ms += scan_now_ms() - t;
+    return;
+  }
+  pthread_mutex_lock(&scan_pool.lock);
+  scan_pool.job = job;
+  scan_pool.pending = scan_pool.nthreads - 1;
+  scan_pool.generation++;
+  pthread_cond_broadcast(&scan_pool.start);
+  pthread_mutex_unlock(&scan_pool.lock);
+
+  job(0);
+
+  pthread_mutex_lock(&scan_pool.lock);
+  while (scan_pool.pending > 0) {
+    pthread_cond_wait(&scan_pool.done, &scan_pool.lock);
+  }
+  pthread_mutex_unlock(&scan_pool.lock);
+  scan_banded_ms += scan_now_ms() - t;
+}
+
+// Reduce the per-thread sums and label the runs of rows [y0, y1) in order
+static void scan_collect(scan_result_t *r, int y0, int y1) {
+  for (int i = 0; i < scan_pool.nthreads; i++) {
+    r->count += scan_pool.part[i].count;
+    r->x_sum += scan_pool.part[i].x_sum;
+    r->y_sum += scan_pool.part[i].y_sum;
+  }
+  for (int row = y0; row < y1; row++) {
+    for (int i = 0; i < scan_nruns[row]; i++) {
+      blob_add_run(&scan_labeler, row, scan_runs[row][i].start, scan_runs[row][i].end);
+    }
+  }
+}
+
+// Scan a rectangle with the whole pool
+static void scan_rect(const classifier_t *c, const uint32_t *frame, const scan_window_t *w, scan_result_t *r) {
+  uint8_t mask[DISP_WIDTH];
+  int npix = w->x1 - w->x0;
+
+  if (scan_pool.nthreads == 1) {
+    for (int row = w->y0; row < w->y1; row++) {
+      c->classify_row(c, &frame[row * FRAME_WORDS_PER_ROW + w->x0 / 2], npix / 2, mask);
+      scan_accumulate(r, mask, npix, w->x0, row);
+    }
+    return;
+  }
+  scan_pool.c = c;
+  scan_pool.frame = frame;
+  scan_pool.window = *w;
+  scan_pool_run(scan_rect_band);
+  scan_collect(r, w->y0, w->y1);
+}
+
+static void scan_begin(scan_result_t *r) {
+  memset(r, 0, sizeof(*r));
+  blob_begin(&scan_labeler);
+}
+
+static void scan_end(scan_result_t *r) {
+  r->nblobs = blob_end(&scan_labeler, r->blobs, BLOB_MAX);
+  r->components = scan_labeler.components;
+  r->rejected = scan_labeler.rejected;
+}
+
+void scan_set_gate(const shape_gate_t *gate) {
+  blob_set_gate(&scan_labeler, gate);
+}
+
+// Coarse hits a tile's neighbourhood needs before it is refined. 1 refines
+// around every hit; more ignores isolated ones, e.g. sensor noise.
+void scan_set_density(int min_hits) {
+  scan_density = (min_hits > 1) ? min_hits : 1;
+}
+
+void scan_full(const classifier_t *c, const uint32_t *frame, scan_result_t *r) {
+  scan_window_t w = {0, 0, DISP_WIDTH, DISP_HEIGHT};
+
+  scan_begin(r);
+  scan_rect(c, frame, &w, r);
+  r->tiles = SCAN_TILES_X * SCAN_TILES_Y;
+  scan_end(r);
+}
+
+// Coarse pass over band 'index' of the grid rows: every SCAN_STRIDE-th
+// row, one word (two pixels) in every SCAN_STRIDE pixels
+static void scan_sample_band(int index) {
+  const classifier_t *c = scan_pool.c;
+  int gr0 = SCAN_GRID_ROWS * index / scan_pool.nthreads;
+  int gr1 = SCAN_GRID_ROWS * (index + 1) / scan_pool.nthreads;
+  uint32_t samples[SCAN_GRID_COLS];
+  uint8_t mask[2 * SCAN_GRID_COLS];
+
+  for (int gr = gr0; gr < gr1; gr++) {
+    const uint32_t *src = &scan_pool.frame[(gr * SCAN_STRIDE + SCAN_STRIDE / 2) * FRAME_WORDS_PER_ROW];
+
+    for (int i = 0; i < SCAN_GRID_COLS; i++) {
+      samples[i] = src[i * SCAN_STRIDE_WORDS];
+    }
+    c->classify_row(c, samples, SCAN_GRID_COLS, mask);
+    for (int i = 0; i < SCAN_GRID_COLS; i++) {
+      scan_hits[gr][i] = mask[2 * i] | mask[2 * i + 1];
+    }
+  }
+}
+
+// Fine pass over band 'index' of the tile rows: find the horizontal runs of
+// marked tiles in each tile row, then classify them into the run table
+static void scan_tile_band(int index) {
+  const classifier_t *c = scan_pool.c;
+  int ty0 = SCAN_TILES_Y * index / scan_pool.nthreads;
+  int ty1 = SCAN_TILES_Y * (index + 1) / scan_pool.nthreads;
+  scan_part_t *p = &scan_pool.part[index];
+  int run_x[SCAN_TILES_X], run_len[SCAN_TILES_X];
+  uint8_t mask[DISP_WIDTH];
+
+  memset(p, 0, sizeof(*p));
+  for (int ty = ty0; ty < ty1; ty++) {
+    int row_end = (ty + 1) * SCAN_TILE;
+    int nruns = 0;
+
+    if (row_end > DISP_HEIGHT) {
+      row_end = DISP_HEIGHT;
+    }
+    for (int tx = 0; tx < SCAN_TILES_X; ) {
+      int run;
+
+      if (!scan_refine[ty][tx]) {
+        tx++;
+        continue;
+      }
+      for (run = 1; tx + run < SCAN_TILES_X && scan_refine[ty][tx + run]; run++)
+        ;
+      run_x[nruns] = tx * SCAN_TILE;
+      run_len[nruns++] = run * SCAN_TILE;
+      tx += run;
+    }
+
+    for (int row = ty * SCAN_TILE; row < row_end; row++) {
+      scan_nruns[row] = 0;
+      for (int i = 0; i < nruns; i++) {
+        c->classify_row(c, &scan_pool.frame[row * FRAME_WORDS_PER_ROW + run_x[i] / 2], run_len[i] / 2, mask);
+        scan_nruns[row] += scan_runs_in(mask, run_len[i], run_x[i], row, &scan_runs[row][scan_nruns[row]], p);
+      }
+    }
+  }
+}
+
+void scan_coarse(const classifier_t *c, const uint32_t *frame, scan_result_t *r) {
+  static uint32_t grid_sum[INTEGRAL_WORDS(SCAN_GRID_COLS, SCAN_GRID_ROWS)];
+  integral_t grid;
+  int gx, gy;
+
+  scan_begin(r);
+  integral_init(&grid, SCAN_GRID_COLS, SCAN_GRID_ROWS, grid_sum);
+  scan_pool.c = c;
+  scan_pool.frame = frame;
+
+  scan_pool_run(scan_sample_band);
+  for (int gr = 0; gr < SCAN_GRID_ROWS; gr++) {
+    integral_row(&grid, gr, scan_hits[gr]);
+  }
+
+  // Refine the tiles with enough hits around them, so target edges past the
+  // last sample are kept
+  for (int ty = 0; ty < SCAN_TILES_Y; ty++) {
+    for (int tx = 0; tx < SCAN_TILES_X; tx++) {
+      scan_refine[ty][tx] = integral_sum(&grid, (tx - 1) * SCAN_TILE_SAMPLES, (ty - 1) * SCAN_TILE_SAMPLES,
+                                         (tx + 2) * SCAN_TILE_SAMPLES, (ty + 2) * SCAN_TILE_SAMPLES) >= (uint32_t)scan_density;
+      r->tiles += scan_refine[ty][tx];
+    }
+  }
+  r->dense_hits = integral_densest(&grid, 3 * SCAN_TILE_SAMPLES, 3 * SCAN_TILE_SAMPLES, &gx, &gy);
+  r->dense = (scan_window_t){gx * SCAN_STRIDE, gy * SCAN_STRIDE,
+                             (gx + 3 * SCAN_TILE_SAMPLES) * SCAN_STRIDE, (gy + 3 * SCAN_TILE_SAMPLES) * SCAN_STRIDE};
+
+  // Bands label nothing themselves, so the labeler still sees rows in order
+  scan_pool_run(scan_tile_band);
+  scan_collect(r, 0, DISP_HEIGHT);
+  scan_end(r);
+}
+
+void scan_window(const classifier_t *c, const uint32_t *frame, const scan_window_t *w, scan_result_t *r) {
+  scan_begin(r);
+  scan_rect(c, frame, w, r);
+  r->tiles = 0;
+  scan_end(r);
+}
@@ -0,0 +1,166 @@
+// frame_sync.c - hand the detector one new, complete frame at a time.
+//
+// The AXI VDMA registers are mapped through /dev/mem next to the frame
+// buffer. With the S2MM channel in circular mode the store just behind the
+// one being written is complete, so frame_sync_wait() polls the park
+// pointer register until the write store moves on. With S2MM parked (as
+// the camera app leaves it) the store being parked on is rewritten every
+// frame, so the write pointer is moved between it and a spare store: after
+// the flip, the end of the frame in progress (S2MM frame count flag) means
+// the old store holds a complete frame that nothing writes until the next
+// call flips back.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "sentry.h"
+
+static uint32_t vdma_read(frame_sync_t *fs, int offset) {
+  return fs->regs[offset / 4];
+}
+
+static void vdma_write(frame_sync_t *fs, int offset, uint32_t value) {
+  fs->regs[offset / 4] = value;
+}
+
+static double sync_now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+static void sync_sleep(void) {
+  struct timespec ts = {0, FRAME_SYNC_POLL_US * 1000};
+
+  nanosleep(&ts, NULL);
+}
+
+// Map a frame store, reusing the mapping if another store has the same address
+static const volatile uint32_t *sync_map_store(frame_sync_t *fs, int store) {
+  uint32_t addr = vdma_read(fs, VDMA_S2MM_START_ADDR(store));
+  void *map;
+
+  fs->store_addr[store] = addr;
+  for (int i = 0; i < store; i++) {
+    if (fs->store_addr[i] == addr) {
+      return fs->store[i];
+    }
+  }
+  map = mmap(NULL, FRAME_SIZE, PROT_READ, MAP_SHARED, fs->mem_fd, addr);
+  if (map == MAP_FAILED) {
+    perror("mmap frame store");
+    return NULL;
+  }
+  return (const volatile uint32_t *)map;
+}
+
+int frame_sync_open(frame_sync_t *fs, int mem_fd) {
+  void *regs;
+
+  memset(fs, 0, sizeof(*fs));
+  fs->mem_fd = mem_fd;
+  regs = mmap(NULL, VDMA_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, VDMA_BASE_ADDR);
+  if (regs == MAP_FAILED) {
+    perror("mmap VDMA registers");
+    return -1;
+  }
+  fs->regs = (volatile uint32_t *)regs;
+
+  fs->nstores = vdma_read(fs, VDMA_FRMSTORE) & 0x1F;
+  if (fs->nstores < 1 || fs->nstores > VDMA_MAX_STORES) {
+    fprintf(stderr, "VDMA reports %d frame stores\n", fs->nstores);
+    return -1;
+  }
+  for (int i = 0; i < fs->nstores; i++) {
+    if ((fs->store[i] = sync_map_store(fs, i)) == NULL) {
+      return -1;
+    }
+  }
+
+  fs->dmacr = vdma_read(fs, VDMA_S2MM_DMACR);
+  fs->parkptr = vdma_read(fs, VDMA_PARKPTR);
+  fs->circular = (fs->dmacr & VDMA_DMACR_CIRCULAR) != 0;
+  fs->last = -1;
+
+  if (!fs->circular) {
+    fs->writing = (fs->parkptr & VDMA_PARKPTR_WRTREF_MASK) >> VDMA_PARKPTR_WRTREF_SHIFT;
+    fs->home = fs->writing;
+    fs->spare = FRAME_SYNC_SPARE_STORE;
+    if (fs->spare >= fs->nstores || fs->spare == fs->home ||
+        fs->store_addr[fs->spare] == fs->store_addr[fs->home]) {
+      fprintf(stderr, "No spare S2MM frame store to flip to\n");
+      return -1;
+    }
+    // Raise the S2MM frame count flag at the end of every frame
+    vdma_write(fs, VDMA_S2MM_DMACR, (fs->dmacr & ~VDMA_DMACR_FRMCNT_MASK) | (1 << VDMA_DMACR_FRMCNT_SHIFT));
+  }
+
+  printf("VDMA S2MM %s, %d frame stores at 0x%08X 0x%08X 0x%08X\n", fs->circular ? "circular" : "parked",
+         fs->nstores, fs->store_addr[0], fs->store_addr[1], fs->store_addr[2]);
+  return 0;
+}
+
+// Block until a frame that hasn't been handed out before is complete, and
+// return its store. NULL if the VDMA stopped producing frames.
+const volatile uint32_t *frame_sync_wait(frame_sync_t *fs) {
+  double start = sync_now_ms();
+  int done;
+
+  if (fs->circular) {
+    for (;;) {
+      int cur = (vdma_read(fs, VDMA_PARKPTR) & VDMA_PARKPTR_WRSTORE_MASK) >> VDMA_PARKPTR_WRSTORE_SHIFT;
+
+      done = (cur + fs->nstores - 1) % fs->nstores;
+      if (done != fs->last) {
+        break;
+      }
+      if (sync_now_ms() - start > FRAME_SYNC_TIMEOUT_MS) {
+        fs->timeouts++;
+        return NULL;
+      }
+      sync_sleep();
+    }
+    if (fs->last >= 0 && done != (fs->last + 1) % fs->nstores) {
+      fs->skipped++;
+    }
+  } else {
+    // Move the writes to the other store first, then clear the flag: the
+    // next flag then marks a frame end after which nothing writes 'done'
+    done = fs->writing;
+    fs->writing = (done == fs->home) ? fs->spare : fs->home;
+    vdma_write(fs, VDMA_PARKPTR, (vdma_read(fs, VDMA_PARKPTR) & ~VDMA_PARKPTR_WRTREF_MASK) |
+                                 (fs->writing << VDMA_PARKPTR_WRTREF_SHIFT));
+    vdma_write(fs, VDMA_S2MM_DMASR, VDMA_DMASR_FRMCNT_IRQ);
+    while ((vdma_read(fs, VDMA_S2MM_DMASR) & VDMA_DMASR_FRMCNT_IRQ) == 0) {
+      if (sync_now_ms() - start > FRAME_SYNC_TIMEOUT_MS) {
+        fs->timeouts++;
+        return NULL;
+      }
+      sync_sleep();
+    }
+  }
+
+  fs->last = done;
+  fs->frames++;
+  fs->wait_ms += sync_now_ms() - start;
+  return fs->store[done];
+}
+
+// Put the write pointer and frame count back the way they were found
+void frame_sync_close(frame_sync_t *fs) {
+  if (fs->regs == NULL) {
+    return;
+  }
+  if (!fs->circular) {
+    vdma_write(fs, VDMA_PARKPTR, fs->parkptr);
+    vdma_write(fs, VDMA_S2MM_DMACR, fs->dmacr);
+  }
+  printf("Frame sync: %d frames, %d skipped, %d timeouts, %.1f ms average wait\n", fs->frames, fs->skipped,
+         fs->timeouts, fs->frames ? fs->wait_ms / fs->frames : 0.0);
+  munmap((void *)fs->regs, VDMA_MAP_SIZE);
+  fs->regs = NULL;
+}
@@ -0,0 +1,413 @@
+// Gallery exporter. Reads the MP2 camera gallery (reserved DDR region, see
+// MP2/Part 7/gallery.h) through /dev/mem or from a dump of that region, and
+// writes every image as a 24-bit bottom-up BMP (same layout as the MP2/Part 5
+// bitmaps) plus a raw YUYV 4:2:2 .yuv file.
+//
+// Both files are produced in one pass over each frame, in bands of rows, with
+// table-driven fixed point color conversion and large writes.
+//
+//   gallery_export [-f dump.bin] [-o outdir] [-n] [-b]
+//     -f  read a dump of the gallery region instead of /dev/mem
+//     -o  output directory (default .)
+//     -n  convert only, do not write files
+//     -b  also time the conversion against a per-pixel floating point version
+//
+// View the raw output with: ffplay -f rawvideo -pix_fmt yuyv422 -s 1920x1080 img_000.yuv
+//
+// Build: gcc -O2 -I../common -o gallery_export gallery_export.c
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "pixel422.h"
+
+#define FRAME_WIDTH                1920
+#define FRAME_HEIGHT               1080
+#define FRAME_BYTES                (FRAME_WIDTH * FRAME_HEIGHT * 2)
+
+#define GALLERY_BASE_ADDR          0x14000000
+#define GALLERY_POOL_OFFSET        0x00010000
+#define GALLERY_POOL_BYTES         (30 * FRAME_BYTES)
+#define GALLERY_MAX_IMAGES         64
+#define GALLERY_MAGIC              0x474C4C59
+#define GALLERY_FMT_RAW422         0
+#define GALLERY_FMT_RLE32          1
+#define RLE32_RUN_FLAG             0x80000000
+
+#define BAND_ROWS                  64
+#define BMP_HEADER_BYTES           54
+#define BMP_ROW_BYTES              (FRAME_WIDTH * 3)    // Already a multiple of 4
+#define YUV_ROW_BYTES              (FRAME_WIDTH * 2)
+
+// Fixed point scale for the color conversion tables
+#define FIX_SHIFT                  16
+#define FIX(x)                     ((int)((x) * (1 << FIX_SHIFT) + ((x) < 0 ? -0.5 : 0.5)))
+#define CLAMP_OFFSET               384
+
+typedef struct {
+  uint32_t format;
+  uint32_t offset;
+  uint32_t size;
+  uint32_t clip_id;
+  uint32_t timestamp;
+} gallery_entry_t;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t num_images;
+  uint32_t pool_used;
+  uint32_t num_packed;
+  uint32_t next_clip_id;
+  gallery_entry_t entries[GALLERY_MAX_IMAGES];
+} gallery_t;
+
+// Inverse of the RGB to YCbCr transform used by the camera app (MP2/Part 5):
+// Y = 0.183R + 0.614G + 0.062B + 16 etc.
+static int tab_y[256];
+static int tab_r_cr[256];
+static int tab_g_cb[256];
+static int tab_g_cr[256];
+static int tab_b_cb[256];
+static unsigned char tab_clamp[1024];
+
+static uint8_t bmp_band[BAND_ROWS * BMP_ROW_BYTES];
+static uint32_t frame_buf[FRAME_BYTES / 4];
+
+
+static double now_sec(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void init_tables(void) {
+  int i;
+
+  for (i = 0; i < 256; i++) {
+    tab_y[i]    = FIX(1.164) * (i - 16) + (1 << (FIX_SHIFT - 1));
+    tab_r_cr[i] = FIX(1.793) * (i - 128);
+    tab_g_cb[i] = -FIX(0.213) * (i - 128);
+    tab_g_cr[i] = -FIX(0.533) * (i - 128);
+    tab_b_cb[i] = FIX(2.112) * (i - 128);
+  }
+  for (i = 0; i < 1024; i++) {
+    tab_clamp[i] = (i < CLAMP_OFFSET) ? 0 : (i > CLAMP_OFFSET + 255) ? 255 : i - CLAMP_OFFSET;
+  }
+}
+
+// One row of [Cr][Y1][Cb][Y0] words to B,G,R bytes
+static void convert_row(const uint32_t *src, uint8_t *dst) {
+  const unsigned char *clamp = tab_clamp + CLAMP_OFFSET;
+  int col;
+  int r, g, b, y;
+
+  for (col = 0; col < FRAME_WIDTH / 2; col++) {
+    uint32_t w = src[col];
+    int cb = pix422_cb(w);
+    int cr = pix422_cr(w);
+
+    r = tab_r_cr[cr];
+    g = tab_g_cb[cb] + tab_g_cr[cr];
+    b = tab_b_cb[cb];
+
+    y = tab_y[pix422_y0(w)];
+    dst[0] = clamp[(y + b) >> FIX_SHIFT];
+    dst[1] = clamp[(y + g) >> FIX_SHIFT];
+    dst[2] = clamp[(y + r) >> FIX_SHIFT];
+
+    y = tab_y[pix422_y1(w)];
+    dst[3] = clamp[(y + b) >> FIX_SHIFT];
+    dst[4] = clamp[(y + g) >> FIX_SHIFT];
+    dst[5] = clamp[(y + r) >> FIX_SHIFT];
+    dst += 6;
+  }
+}
+
+// Per-pixel floating point version, only used for the -b comparison
+static void convert_row_float(const uint32_t *src, uint8_t *dst) {
+  int col, k;
+  double r, g, b, y;
+
+  for (col = 0; col < FRAME_WIDTH; col++) {
+    uint32_t w = src[col / 2];
+    double cb = pix422_cb(w) - 128.0;
+    double cr = pix422_cr(w) - 128.0;
+
+    y = 1.164 * ((double)pix422_y(w, col & 1) - 16.0);
+    r = y + 1.793 * cr;
+    g = y - 0.213 * cb - 0.533 * cr;
+    b = y + 2.112 * cb;
+
+    double c[3] = {b, g, r};
+    for (k = 0; k < 3; k++) {
+      dst[k] = (c[k] < 0) ? 0 : (c[k] > 255) ? 255 : (uint8_t)(c[k] + 0.5);
+    }
+    dst += 3;
+  }
+}
+
+// Decode nbytes of src into dst, which holds dst_words words. The counts
+// come from whatever file -f named, so any run or literal that overruns
+// either buffer, or an image that isn't exactly dst_words long, is refused.
+static int rle32_decode(const uint32_t *src, uint32_t nbytes, uint32_t *dst, uint32_t dst_words) {
+  const uint32_t *end = src + nbytes / 4;
+  uint32_t *dst_end = dst + dst_words;
+  uint32_t count, value;
+
+  while (src < end) {
+    count = *src++;
+    if (count & RLE32_RUN_FLAG) {
+      count &= ~RLE32_RUN_FLAG;
+      if (src == end || count > (uint32_t)(dst_end - dst)) {
+        return -1;
+      }
+      value = *src++;
+      while (count--) {
+        *dst++ = value;
+      }
+    } else {
+      if (count > (uint32_t)(end - src) || count > (uint32_t)(dst_end - dst)) {
+        return -1;
+      }
+      memcpy(dst, src, count * 4);
+      dst += count;
+      src += count;
+    }
+  }
+  return (dst == dst_end) ? 0 : -1;
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+  p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static void bmp_header(uint8_t *h) {
+  memset(h, 0, BMP_HEADER_BYTES);
+  h[0] = 'B';
+  h[1] = 'M';
+  put_le32(h + 2, BMP_HEADER_BYTES + BMP_ROW_BYTES * FRAME_HEIGHT);
+  put_le32(h + 10, BMP_HEADER_BYTES);
+  put_le32(h + 14, 40);                 // BITMAPINFOHEADER
+  put_le32(h + 18, FRAME_WIDTH);
+  put_le32(h + 22, FRAME_HEIGHT);       // Positive height, bottom-up rows
+  h[26] = 1;                            // Planes
+  h[28] = 24;                           // Bits per pixel
+  put_le32(h + 34, BMP_ROW_BYTES * FRAME_HEIGHT);
+}
+
+static int write_all(int fd, const void *buf, size_t len, off_t offset) {
+  const uint8_t *p = buf;
+  ssize_t n;
+
+  while (len > 0) {
+    n = pwrite(fd, p, len, offset);
+    if (n <= 0) {
+      return -1;
+    }
+    p += n;
+    len -= n;
+    offset += n;
+  }
+  return 0;
+}
+
+// Export one decoded frame. The BMP is bottom-up, so bands are walked from the
+// bottom of the frame; the .yuv rows of each band are written at their own
+// offset so that file stays top-down.
+static int export_frame(const uint32_t *frame, int bmp_fd, int yuv_fd, double *convert_time) {
+  uint8_t header[BMP_HEADER_BYTES];
+  off_t bmp_off = BMP_HEADER_BYTES;
+  double t;
+  int top, row, rows;
+
+  if (bmp_fd >= 0) {
+    bmp_header(header);
+    if (write_all(bmp_fd, header, BMP_HEADER_BYTES, 0) < 0) {
+      return -1;
+    }
+  }
+
+  for (top = FRAME_HEIGHT; top > 0; top -= rows) {
+    rows = (top < BAND_ROWS) ? top : BAND_ROWS;
+
+    t = now_sec();
+    for (row = 0; row < rows; row++) {
+      convert_row(frame + (top - 1 - row) * (FRAME_WIDTH / 2), bmp_band + row * BMP_ROW_BYTES);
+    }
+    *convert_time += now_sec() - t;
+
+    if (bmp_fd >= 0 && write_all(bmp_fd, bmp_band, rows * BMP_ROW_BYTES, bmp_off) < 0) {
+      return -1;
+    }
+    if (yuv_fd >= 0 && write_all(yuv_fd, frame + (top - rows) * (FRAME_WIDTH / 2), rows * YUV_ROW_BYTES,
+                                 (off_t)(top - rows) * YUV_ROW_BYTES) < 0) {
+      return -1;
+    }
+    bmp_off += rows * BMP_ROW_BYTES;
+  }
+
+  return 0;
+}
+
+static void benchmark(const uint32_t *frame) {
+  double t0, t_fix, t_float;
+  int row;
+
+  t0 = now_sec();
+  for (row = 0; row < FRAME_HEIGHT; row++) {
+    convert_row(frame + row * (FRAME_WIDTH / 2), bmp_band);
+  }
+  t_fix = now_sec() - t0;
+
+  t0 = now_sec();
+  for (row = 0; row < FRAME_HEIGHT; row++) {
+    convert_row_float(frame + row * (FRAME_WIDTH / 2), bmp_band);
+  }
+  t_float = now_sec() - t0;
+
+  printf("  convert: fixed %.2f ms (%.0f Mpix/s), float %.2f ms (%.0f Mpix/s)\n",
+         t_fix * 1e3, FRAME_WIDTH * FRAME_HEIGHT / t_fix / 1e6,
+         t_float * 1e3, FRAME_WIDTH * FRAME_HEIGHT / t_float / 1e6);
+}
+
+int main(int argc, char *argv[]) {
+  const char *dump = NULL;
+  const char *outdir = ".";
+  int no_write = 0;
+  int bench = 0;
+  int opt;
+
+  int src_fd;
+  size_t map_size = GALLERY_POOL_OFFSET + GALLERY_POOL_BYTES;
+  uint8_t *region;
+  const gallery_t *gallery;
+  const uint8_t *pool;
+  const uint32_t *frame;
+  char path[512];
+  int bmp_fd, yuv_fd;
+  uint32_t i, exported = 0;
+  double t_start, t_total, t_convert = 0;
+  double bytes_out = 0;
+
+  while ((opt = getopt(argc, argv, "f:o:nb")) != -1) {
+    switch (opt) {
+      case 'f': dump = optarg; break;
+      case 'o': outdir = optarg; break;
+      case 'n': no_write = 1; break;
+      case 'b': bench = 1; break;
+      default:
+        fprintf(stderr, "Usage: %s [-f dump.bin] [-o outdir] [-n] [-b]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  if (dump != NULL) {
+    struct stat st;
+
+    if ((src_fd = open(dump, O_RDONLY)) < 0) {
+      perror("Couldn't open gallery dump");
+      exit(EXIT_FAILURE);
+    }
+    if (fstat(src_fd, &st) < 0 || st.st_size < (off_t)sizeof(gallery_t)) {
+      fprintf(stderr, "%s is too small to be a gallery dump\n", dump);
+      exit(EXIT_FAILURE);
+    }
+    if ((size_t)st.st_size < map_size) {
+      map_size = st.st_size;
+    }
+    region = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, src_fd, 0);
+  } else {
+    if ((src_fd = open("/dev/mem", O_RDONLY)) < 0) {
+      perror("Couldn't open file /dev/mem");
+      exit(EXIT_FAILURE);
+    }
+    region = mmap(NULL, map_size, PROT_READ, MAP_SHARED, src_fd, GALLERY_BASE_ADDR);
+  }
+  if (region == MAP_FAILED) {
+    perror("mmap");
+    close(src_fd);
+    exit(EXIT_FAILURE);
+  }
+
+  gallery = (const gallery_t *)region;
+  pool = region + GALLERY_POOL_OFFSET;
+  if (gallery->magic != GALLERY_MAGIC || gallery->num_images > GALLERY_MAX_IMAGES) {
+    fprintf(stderr, "No gallery found (magic %08X)\n", gallery->magic);
+    exit(EXIT_FAILURE);
+  }
+
+  init_tables();
+  printf("Exporting %u images\n", gallery->num_images);
+
+  t_start = now_sec();
+  for (i = 0; i < gallery->num_images; i++) {
+    const gallery_entry_t *e = &gallery->entries[i];
+
+    if (GALLERY_POOL_OFFSET + (size_t)e->offset + e->size > map_size) {
+      fprintf(stderr, "Image %u lies outside the gallery region, skipped\n", i);
+      continue;
+    }
+
+    if (e->format == GALLERY_FMT_RLE32) {
+      if (rle32_decode((const uint32_t *)(pool + e->offset), e->size, frame_buf, FRAME_BYTES / 4) < 0) {
+        fprintf(stderr, "Image %u is corrupt, skipped\n", i);
+        continue;
+      }
+      frame = frame_buf;
+    } else if (e->size < FRAME_BYTES) {
+      fprintf(stderr, "Image %u is shorter than a frame, skipped\n", i);
+      continue;
+    } else {
+      frame = (const uint32_t *)(pool + e->offset);
+    }
+
+    bmp_fd = yuv_fd = -1;
+    if (!no_write) {
+      snprintf(path, sizeof(path), "%s/img_%03u.bmp", outdir, i);
+      bmp_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      snprintf(path, sizeof(path), "%s/img_%03u.yuv", outdir, i);
+      yuv_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (bmp_fd < 0 || yuv_fd < 0) {
+        perror("Couldn't create output file");
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    if (export_frame(frame, bmp_fd, yuv_fd, &t_convert) < 0) {
+      perror("write");
+      exit(EXIT_FAILURE);
+    }
+    bytes_out += BMP_HEADER_BYTES + BMP_ROW_BYTES * FRAME_HEIGHT + FRAME_BYTES;
+    exported++;
+
+    if (!no_write) {
+      close(bmp_fd);
+      close(yuv_fd);
+    }
+
+    printf("img_%03u: %s, clip %u\n", i, (e->format == GALLERY_FMT_RLE32) ? "rle32" : "raw", e->clip_id);
+    if (bench) {
+      benchmark(frame);
+    }
+  }
+  t_total = now_sec() - t_start;
+
+  if (exported > 0) {
+    printf("----------------------------\n");
+    printf("%u images, %.1f MB in %.3f s: %.1f MB/s overall, conversion alone %.1f MB/s\n",
+           exported, bytes_out / 1e6, t_total, bytes_out / t_total / 1e6,
+           bytes_out / t_convert / 1e6);
+    printf("Conversion is %.0f%% of the export time\n", 100.0 * t_convert / t_total);
+  }
+
+  munmap(region, map_size);
+  close(src_fd);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,433 @@
+// hough_circle.c - find round targets with a gradient Hough transform.
+//
+// The Y plane is reduced to quarter resolution with the template matcher's
+// pyramid rows, and Sobel gradients are taken over it, eight pixels at a
+// time with NEON or SSE2. Only pixels with a strong gradient take part.
+//
+// The centre of a circle lies along the gradient of each of its edge
+// pixels, at the circle's radius, on one side or the other depending on
+// whether the target is lighter or darker than what is behind it. So each
+// edge pixel votes for the cells along its gradient line, both ways, from
+// the smallest radius to the largest. The accumulator holds only centres,
+// one 16-bit count per cell of the plane, and the cost is one vote per
+// edge pixel per radius rather than one per edge pixel per radius per
+// angle.
+//
+// Centres are the peaks of the 3x3 sums of the accumulator that are the
+// largest within +-HOUGH_NMS cells. For each, the edge pixels whose
+// gradient points at it are binned by distance, and the radius is the
+// outermost one around which enough of the circle is found: the rings of
+// a bullseye share a centre, and the outermost is the target's size.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sentry.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HOUGH_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define HOUGH_SSE2
+#endif
+
+#define HOUGH_SECTORS              32   // Angular sectors a circle's support is counted in
+#define HOUGH_CANDIDATES           (2 * BLOB_MAX) // Centres checked for a radius
+
+// Level pixel i covers full resolution pixels 4i to 4i + 3
+#define HOUGH_TO_FRAME(c)          (((c) + 0.5) * (1 << HOUGH_LEVEL) - 0.5)
+
+typedef struct {
+  int x, y;
+  int votes;
+} hough_peak_t;
+
+static double hough_now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Set the radius range, in full resolution pixels
+int hough_init(hough_t *h, int min_r, int max_r) {
+  h->min_r = min_r >> HOUGH_LEVEL;
+  h->max_r = max_r >> HOUGH_LEVEL;
+  if (h->min_r < 2 || h->max_r < h->min_r || h->max_r > HOUGH_HEIGHT / 2) {
+    fprintf(stderr, "Radius range %d to %d is outside %d to %d\n", min_r, max_r, 2 << HOUGH_LEVEL,
+            (HOUGH_HEIGHT / 2) << HOUGH_LEVEL);
+    return -1;
+  }
+  h->nedges = h->dropped = h->ncircles = 0;
+  return 0;
+}
+
+// Quarter resolution Y plane: two half resolution rows, then their mean
+static void hough_plane(hough_t *h, const uint32_t *frame) {
+  static uint8_t half[2][DISP_WIDTH / 2];
+
+  for (int y = 0; y < HOUGH_HEIGHT; y++) {
+    const uint32_t *src = &frame[4 * y * FRAME_WORDS_PER_ROW];
+
+    template_reduce_frame_row(src, src + FRAME_WORDS_PER_ROW, half[0]);
+    template_reduce_frame_row(src + 2 * FRAME_WORDS_PER_ROW, src + 3 * FRAME_WORDS_PER_ROW, half[1]);
+    template_reduce_row(half[0], half[1], h->plane[y], HOUGH_WIDTH);
+  }
+}
+
+// Keep the pixels of gx, gy that are edges
+static void hough_add_edges(hough_t *h, int x, int y, const int16_t *gx, const int16_t *gy, int n) {
+  for (int i = 0; i < n; i++) {
+    if (abs(gx[i]) + abs(gy[i]) < HOUGH_EDGE) {
+      continue;
+    }
+    if (h->nedges == HOUGH_MAX_EDGES) {
+      h->dropped++;
+      continue;
+    }
+    h->edges[h->nedges++] = (hough_edge_t){x + i, y, gx[i], gy[i]};
+  }
+}
+
+// Sobel gradients along plane row y, 1 <= y < HOUGH_HEIGHT - 1
+static void hough_edges_row(hough_t *h, int y) {
+  const uint8_t *a = h->plane[y - 1], *b = h->plane[y], *c = h->plane[y + 1];
+  int16_t gx[8], gy[8];
+  int x = 1;
+
+#if defined(HOUGH_NEON)
+  const int16x8_t edge = vdupq_n_s16(HOUGH_EDGE);
+
+  for (; x + 8 < HOUGH_WIDTH; x += 8) {
+    int16x8_t a0 = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(a + x - 1)));
+    int16x8_t a1 = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(a + x)));
+    int16x8_t a2 = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(a + x + 1)));
+    int16x8_t b0 = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(b + x - 1)));
+    int16x8_t b2 = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(b + x + 1)));
+    int16x8_t c0 = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(c + x - 1)));
+    int16x8_t c1 = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(c + x)));
+    int16x8_t c2 = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(c + x + 1)));
+    int16x8_t vx = vaddq_s16(vaddq_s16(vsubq_s16(a2, a0), vsubq_s16(c2, c0)), vshlq_n_s16(vsubq_s16(b2, b0), 1));
+    int16x8_t vy = vaddq_s16(vsubq_s16(vaddq_s16(c0, c2), vaddq_s16(a0, a2)), vshlq_n_s16(vsubq_s16(c1, a1), 1));
+    uint16x8_t hit = vcgeq_s16(vaddq_s16(vabsq_s16(vx), vabsq_s16(vy)), edge);
+
+    if (vget_lane_u64(vreinterpret_u64_u8(vmovn_u16(hit)), 0) == 0) {
+      continue;
+    }
+    vst1q_s16(gx, vx);
+    vst1q_s16(gy, vy);
+    hough_add_edges(h, x, y, gx, gy, 8);
+  }
+#elif defined(HOUGH_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i edge = _mm_set1_epi16(HOUGH_EDGE - 1);
+
+  for (; x + 8 < HOUGH_WIDTH; x += 8) {
+    __m128i a0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(a + x - 1)), zero);
+    __m128i a1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(a + x)), zero);
+    __m128i a2 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(a + x + 1)), zero);
+    __m128i b0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(b + x - 1)), zero);
+    __m128i b2 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(b + x + 1)), zero);
+    __m128i c0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(c + x - 1)), zero);
+    __m128i c1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(c + x)), zero);
+    __m128i c2 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(c + x + 1)), zero);
+    __m128i vx = _mm_add_epi16(_mm_add_epi16(_mm_sub_epi16(a2, a0), _mm_sub_epi16(c2, c0)),
+                               _mm_slli_epi16(_mm_sub_epi16(b2, b0), 1));
+    __m128i vy = _mm_add_epi16(_mm_sub_epi16(_mm_add_epi16(c0, c2), _mm_add_epi16(a0, a2)),
+                               _mm_slli_epi16(_mm_sub_epi16(c1, a1), 1));
+    __m128i mag = _mm_add_epi16(_mm_max_epi16(vx, _mm_sub_epi16(zero, vx)),
+                                _mm_max_epi16(vy, _mm_sub_epi16(zero, vy)));
+
+    if (_mm_movemask_epi8(_mm_cmpgt_epi16(mag, edge)) == 0) {
+      continue;
+    }
+    _mm_storeu_si128((__m128i *)gx, vx);
+    _mm_storeu_si128((__m128i *)gy, vy);
+    hough_add_edges(h, x, y, gx, gy, 8);
+  }
+#endif
+  for (; x < HOUGH_WIDTH - 1; x++) {
+    gx[0] = (a[x + 1] - a[x - 1]) + 2 * (b[x + 1] - b[x - 1]) + (c[x + 1] - c[x - 1]);
+    gy[0] = (c[x - 1] + 2 * c[x] + c[x + 1]) - (a[x - 1] + 2 * a[x] + a[x + 1]);
+    hough_add_edges(h, x, y, gx, gy, 1);
+  }
+}
+
+// Vote for the centres along e's gradient, both ways, in 16.16 fixed point.
+// A step is one cell long, so no cell gets more than two votes from one
+// edge pixel and HOUGH_MAX_EDGES keeps the counts within 16 bits.
+static void hough_vote(hough_t *h, const hough_edge_t *e) {
+  double mag = sqrt((double)e->gx * e->gx + (double)e->gy * e->gy);
+  int32_t ux = (int32_t)(e->gx * 65536.0 / mag);
+  int32_t uy = (int32_t)(e->gy * 65536.0 / mag);
+
+  for (int dir = -1; dir <= 1; dir += 2) {
+    int32_t px = (e->x << 16) + 32768 + dir * h->min_r * ux;
+    int32_t py = (e->y << 16) + 32768 + dir * h->min_r * uy;
+
+    for (int r = h->min_r; r <= h->max_r; r++) {
+      int x = px >> 16, y = py >> 16;
+
+      if ((unsigned)x >= HOUGH_WIDTH || (unsigned)y >= HOUGH_HEIGHT) {
+        break;
+      }
+      h->acc[y][x]++;
+      px += dir * ux;
+      py += dir * uy;
+    }
+  }
+}
+
+// Votes in the 3x3 cells around (x, y), 1 <= x < HOUGH_WIDTH - 1 and
+// 1 <= y < HOUGH_HEIGHT - 1
+static int hough_sum3(const hough_t *h, int x, int y) {
+  int s = 0;
+
+  for (int j = -1; j <= 1; j++) {
+    s += h->acc[y + j][x - 1] + h->acc[y + j][x] + h->acc[y + j][x + 1];
+  }
+  return s;
+}
+
+// Is the 3x3 sum at (x, y), s, the largest within +-HOUGH_NMS cells? Ties
+// go to the first in raster order.
+static int hough_is_peak(const hough_t *h, int x, int y, int s) {
+  for (int j = -HOUGH_NMS; j <= HOUGH_NMS; j++) {
+    for (int i = -HOUGH_NMS; i <= HOUGH_NMS; i++) {
+      int xx = x + i, yy = y + j, n;
+
+      if ((i == 0 && j == 0) || xx < 1 || yy < 1 || xx >= HOUGH_WIDTH - 1 || yy >= HOUGH_HEIGHT - 1) {
+        continue;
+      }
+      n = hough_sum3(h, xx, yy);
+      if (n > s || (n == s && (j < 0 || (j == 0 && i < 0)))) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+// Radius of the circle centred near (cx, cy), from the edge pixels facing
+// it, and the centre again from those on that radius. Returns 0 when no
+// radius in range has enough of its edge.
+static int hough_radius(const hough_t *h, double cx, double cy, circle_t *c) {
+  static uint32_t sectors[HOUGH_HEIGHT / 2 + 2];
+  static double dsum[HOUGH_HEIGHT / 2 + 2];
+  static int count[HOUGH_HEIGHT / 2 + 2];
+  double reach = h->max_r + 1;
+  double sx = 0, sy = 0;
+  int best = 0, n = 0;
+
+  memset(sectors, 0, (h->max_r + 2) * sizeof(sectors[0]));
+  memset(dsum, 0, (h->max_r + 2) * sizeof(dsum[0]));
+  memset(count, 0, (h->max_r + 2) * sizeof(count[0]));
+  for (int i = 0; i < h->nedges; i++) {
+    const hough_edge_t *e = &h->edges[i];
+    double dx = e->x - cx, dy = e->y - cy, d, g;
+    int bin, sector;
+
+    if (fabs(dx) > reach || fabs(dy) > reach) {
+      continue;
+    }
+    d = sqrt(dx * dx + dy * dy);
+    bin = (int)(d + 0.5);
+    if (bin < h->min_r - 1 || bin > h->max_r + 1) {
+      continue;
+    }
+    g = sqrt((double)e->gx * e->gx + (double)e->gy * e->gy);
+    if (fabs(e->gx * dx + e->gy * dy) < HOUGH_ALIGN * g * d) {
+      continue;
+    }
+    sector = (int)((atan2(dy, dx) + M_PI) * (HOUGH_SECTORS / (2 * M_PI))) & (HOUGH_SECTORS - 1);
+    sectors[bin] |= 1u << sector;
+    dsum[bin] += d;
+    count[bin]++;
+  }
+
+  // Outermost ring with enough support, then in or out to where most of
+  // its edge pixels are (a blurred edge is more than one bin wide)
+  for (int r = h->max_r; r >= h->min_r && best == 0; r--) {
+    if (__builtin_popcount(sectors[r - 1] | sectors[r] | sectors[r + 1]) >= HOUGH_MIN_SUPPORT * HOUGH_SECTORS) {
+      best = r;
+    }
+  }
+  if (best == 0) {
+    return 0;
+  }
+  for (int r = best - 1; r <= best + 1; r++) {
+    if (r >= h->min_r && r <= h->max_r &&
+        count[r - 1] + count[r] + count[r + 1] > count[best - 1] + count[best] + count[best + 1]) {
+      best = r;
+    }
+  }
+  c->support = (double)__builtin_popcount(sectors[best - 1] | sectors[best] | sectors[best + 1]) / HOUGH_SECTORS;
+  c->r = (dsum[best - 1] + dsum[best] + dsum[best + 1]) / (count[best - 1] + count[best] + count[best + 1]);
+
+  // Each edge pixel on the ring puts the centre c->r along its gradient
+  for (int i = 0; i < h->nedges; i++) {
+    const hough_edge_t *e = &h->edges[i];
+    double dx = e->x - cx, dy = e->y - cy, d, g, k;
+
+    if (fabs(dx) > reach || fabs(dy) > reach) {
+      continue;
+    }
+    d = sqrt(dx * dx + dy * dy);
+    g = sqrt((double)e->gx * e->gx + (double)e->gy * e->gy);
+    if (fabs(d - c->r) > 1.5 || fabs(e->gx * dx + e->gy * dy) < HOUGH_ALIGN * g * d) {
+      continue;
+    }
+    k = (e->gx * dx + e->gy * dy > 0) ? -c->r / g : c->r / g;
+    sx += e->x + k * e->gx;
+    sy += e->y + k * e->gy;
+    n++;
+  }
+  c->x = sx / n;
+  c->y = sy / n;
+  return 1;
+}
+
+// Look for circles in a frame. Each is reported as a blob with the area
+// and moments of a disc, so the tracker can follow it like any other.
+void hough_scan(hough_t *h, const uint32_t *frame, scan_result_t *r) {
+  hough_peak_t peaks[HOUGH_CANDIDATES];
+  int npeaks = 0;
+
+  memset(r, 0, sizeof(*r));
+  hough_plane(h, frame);
+  h->nedges = h->dropped = 0;
+  for (int y = 1; y < HOUGH_HEIGHT - 1; y++) {
+    hough_edges_row(h, y);
+  }
+  memset(h->acc, 0, sizeof(h->acc));
+  for (int i = 0; i < h->nedges; i++) {
+    hough_vote(h, &h->edges[i]);
+  }
+
+  // The best centres, most votes first
+  for (int y = 1; y < HOUGH_HEIGHT - 1; y++) {
+    for (int x = 1; x < HOUGH_WIDTH - 1; x++) {
+      int s, k;
+
+      if (h->acc[y][x] == 0 || (s = hough_sum3(h, x, y)) < HOUGH_MIN_VOTES ||
+          (npeaks == HOUGH_CANDIDATES && s <= peaks[npeaks - 1].votes) || !hough_is_peak(h, x, y, s)) {
+        continue;
+      }
+      k = (npeaks < HOUGH_CANDIDATES) ? npeaks++ : npeaks - 1;
+      for (; k > 0 && peaks[k - 1].votes < s; k--) {
+        peaks[k] = peaks[k - 1];
+      }
+      peaks[k] = (hough_peak_t){x, y, s};
+    }
+  }
+
+  h->ncircles = 0;
+  for (int k = 0; k < npeaks && h->ncircles < BLOB_MAX; k++) {
+    const hough_peak_t *p = &peaks[k];
+    double cx = 0, cy = 0, area;
+    circle_t *c = &h->circles[h->ncircles];
+    blob_t *b = &r->blobs[h->ncircles];
+
+    // Centre to a fraction of a cell, from the votes around the peak
+    for (int j = -1; j <= 1; j++) {
+      for (int i = -1; i <= 1; i++) {
+        cx += (p->x + i) * h->acc[p->y + j][p->x + i];
+        cy += (p->y + j) * h->acc[p->y + j][p->x + i];
+      }
+    }
+    cx /= p->votes;
+    cy /= p->votes;
+    if (!hough_radius(h, cx, cy, c)) {
+      continue;
+    }
+    c->x = HOUGH_TO_FRAME(c->x);
+    c->y = HOUGH_TO_FRAME(c->y);
+    c->r *= 1 << HOUGH_LEVEL;
+    c->votes = p->votes;
+    h->ncircles++;
+
+    area = M_PI * c->r * c->r;
+    b->area = (int)(area + 0.5);
+    b->x_min = (int)(c->x - c->r);
+    b->x_max = (int)(c->x + c->r);
+    b->y_min = (int)(c->y - c->r);
+    b->y_max = (int)(c->y + c->r);
+    b->x_sum = (int64_t)(c->x * area);
+    b->y_sum = (int64_t)(c->y * area);
+    b->xx_sum = (int64_t)((c->x * c->x + c->r * c->r / 4) * area);
+    b->yy_sum = (int64_t)((c->y * c->y + c->r * c->r / 4) * area);
+    b->xy_sum = (int64_t)(c->x * c->y * area);
+    r->count += b->area;
+    r->x_sum += b->x_sum;
+    r->y_sum += b->y_sum;
+  }
+  r->nblobs = h->ncircles;
+  r->components = npeaks;
+}
+
+// Draw three rings and a square over noise, and check each ring is found
+// within a pixel or two. Returns the number of misses.
+long hough_verify(void) {
+  static const circle_t rings[] = {{400, 300, 90, 0, 0}, {1300, 700, 40, 0, 0}, {1500, 250, 120, 0, 0}};
+  const int nrings = sizeof(rings) / sizeof(rings[0]);
+  hough_t *h = malloc(sizeof(hough_t));
+  uint32_t *frame = malloc(FRAME_SIZE);
+  scan_result_t r;
+  long misses = 0;
+  double t;
+
+  if (h == NULL || frame == NULL || hough_init(h, HOUGH_MIN_RADIUS, HOUGH_MAX_RADIUS) < 0) {
+    free(h);
+    free(frame);
+    return 1;
+  }
+  srand(1);
+  for (int y = 0; y < DISP_HEIGHT; y++) {
+    for (int x = 0; x < DISP_WIDTH; x += 2) {
+      uint32_t yy = 100 + rand() % 24;
+
+      for (int k = 0; k < nrings; k++) {
+        double dx = x + 0.5 - rings[k].x, dy = y - rings[k].y;
+
+        if (dx * dx + dy * dy <= rings[k].r * rings[k].r) {
+          yy = (k & 1) ? 30 : 200;
+        }
+      }
+      if (x >= 800 && x < 900 && y >= 200 && y < 300) {
+        yy = 220;
+      }
+      frame[y * FRAME_WORDS_PER_ROW + x / 2] = 0x80008000 | yy << 16 | yy;
+    }
+  }
+
+  t = hough_now_ms();
+  hough_scan(h, frame, &r);
+  t = hough_now_ms() - t;
+  for (int k = 0; k < nrings; k++) {
+    int found = 0;
+
+    for (int i = 0; i < h->ncircles; i++) {
+      const circle_t *c = &h->circles[i];
+
+      if (fabs(c->x - rings[k].x) <= 2 && fabs(c->y - rings[k].y) <= 2 && fabs(c->r - rings[k].r) <= 3) {
+        found = 1;
+      }
+    }
+    if (!found) {
+      printf("Circle %d at (%.0f, %.0f) radius %.0f not found\n", k, rings[k].x, rings[k].y, rings[k].r);
+      misses++;
+    }
+  }
+  for (int i = 0; i < h->ncircles; i++) {
+    printf("Circle at (%.1f, %.1f) radius %.1f, %d votes, %.0f%% of the edge\n", h->circles[i].x,
+           h->circles[i].y, h->circles[i].r, h->circles[i].votes, 100 * h->circles[i].support);
+  }
+  printf("Hough circles: %d found in %.1f ms (%d edge pixels), %ld of %d missed\n", h->ncircles, t, h->nedges,
+         misses, nrings);
+  free(h);
+  free(frame);
+  return misses;
+}
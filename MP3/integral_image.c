@@ -0,0 +1,57 @@
+// integral_image.c - check of the summed-area tables in
+// common/integral_image.h (-v).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sentry.h"
+
+#define INTEGRAL_VERIFY_W          333  // Not a multiple of the vector width
+#define INTEGRAL_VERIFY_H          71
+#define INTEGRAL_VERIFY_RECTS      100000
+
+// Check the vector row builder and the rectangle sums against brute force
+// on random bytes. Returns the number of mismatches.
+long integral_verify(void) {
+  static uint8_t img[INTEGRAL_VERIFY_H][INTEGRAL_VERIFY_W];
+  static uint32_t sum[INTEGRAL_WORDS(INTEGRAL_VERIFY_W, INTEGRAL_VERIFY_H)];
+  uint32_t ref[INTEGRAL_VERIFY_W + 1];
+  uint32_t above[INTEGRAL_VERIFY_W] = {0};
+  integral_t ii;
+  long row_errors = 0, rect_errors = 0;
+
+  srand(488);
+  for (int y = 0; y < INTEGRAL_VERIFY_H; y++) {
+    for (int x = 0; x < INTEGRAL_VERIFY_W; x++) {
+      // Mostly saturated, to find any carry that doesn't make it across
+      img[y][x] = (rand() % 4) ? 255 : rand() & 0xFF;
+    }
+  }
+
+  integral_init(&ii, INTEGRAL_VERIFY_W, INTEGRAL_VERIFY_H, sum);
+  integral_build(&ii, &img[0][0], INTEGRAL_VERIFY_W);
+  for (int y = 0; y < INTEGRAL_VERIFY_H; y++) {
+    integral_row_scalar(img[y], INTEGRAL_VERIFY_W, above, ref, 0);
+    for (int x = 0; x < INTEGRAL_VERIFY_W; x++) {
+      row_errors += (sum[(y + 1) * ii.stride + x + 1] != ref[x]);
+    }
+    memcpy(above, ref, sizeof(above));
+  }
+
+  for (int k = 0; k < INTEGRAL_VERIFY_RECTS; k++) {
+    int x0 = rand() % INTEGRAL_VERIFY_W, x1 = x0 + rand() % (INTEGRAL_VERIFY_W - x0) + 1;
+    int y0 = rand() % INTEGRAL_VERIFY_H, y1 = y0 + rand() % 8 + 1;
+    uint32_t s = 0;
+
+    for (int y = y0; y < y1 && y < INTEGRAL_VERIFY_H; y++) {
+      for (int x = x0; x < x1; x++) {
+        s += img[y][x];
+      }
+    }
+    rect_errors += (integral_sum(&ii, x0, y0, x1, y1) != s);
+  }
+
+  printf("Verified %dx%d integral image and %d rectangle sums: %ld row and %ld sum mismatches\n",
+         INTEGRAL_VERIFY_W, INTEGRAL_VERIFY_H, INTEGRAL_VERIFY_RECTS, row_errors, rect_errors);
+  return row_errors + rect_errors;
+}
@@ -8,10 +8,17 @@
 #include <linux/uaccess.h>
 #include <linux/usb.h>
 #include <linux/mutex.h>
+#include <linux/ktime.h>
 
 MODULE_AUTHOR("CprE 488 - Students");
 MODULE_DESCRIPTION("A USB driver for controlling a missle launcher");
 
+/* Log how long each write spends in the USB transfer and in all, to line up
+   with the sentry's trace: insmod launcher-driver.ko trace_writes=1 */
+static bool trace_writes;
+module_param(trace_writes, bool, 0644);
+MODULE_PARM_DESC(trace_writes, "Log the time taken by each write");
+
 // Launcher control message values
 #define LAUNCHER_CLASS_NAME            "launcher%d"
 #define LAUNCHER_DRIVER_NAME           "launcher"
@@ -491,6 +498,8 @@ static ssize_t launcher_write(struct file *file, const char __user *user_cmd,
     char *cmd_buf = NULL;
 	int i;
 	size_t writesize = count;
+	ktime_t write_start = ktime_get();
+	ktime_t usb_start, usb_end;
 
 
 	printk(KERN_INFO "Entering Launcher Write..\n");
@@ -532,6 +541,7 @@ static ssize_t launcher_write(struct file *file, const char __user *user_cmd,
 	}
 
     /* Send the control message */
+    usb_start = ktime_get();
     retval = usb_control_msg(dev->udev,
                              usb_sndctrlpipe(dev->udev, 0),
                              LAUNCHER_CTRL_REQUEST,
@@ -541,6 +551,11 @@ static ssize_t launcher_write(struct file *file, const char __user *user_cmd,
                              cmd_buf, /* Data buffer */
                              LAUNCHER_CTRL_BUFFER_SIZE , /* Data buffer length */
                              5000 /* Timeout in ms */);
+    usb_end = ktime_get();
+
+	if (trace_writes)
+		dev_info(&dev->interface->dev, "cmd 0x%02x: %lld us in usb_control_msg, %lld us in write\n",
+			 dev->cmd, ktime_us_delta(usb_end, usb_start), ktime_us_delta(usb_end, write_start));
 
 
 	printk(KERN_INFO "retval usb_control_msg(): %d\n", retval);
@@ -1,98 +1,707 @@
+// Build: gcc -O2 -I../common -o launcher_fire_camera launcher_fire_camera.c target_classify.c frame_scan.c integral_image.c blob_label.c tracker.c camshift.c template_match.c hough_circle.c aim_control.c motion_detect.c frame_acquire.c frame_sync.c actuator.c trace.c scene_sim.c -lm -lpthread
+// Replay on a host: ./launcher_fire_camera -r frames.yuv (frames back to back, no hardware needed)
 #include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
+#include <time.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <math.h>
 
-#define LAUNCHER_NODE           "/dev/launcher0"
-#define LAUNCHER_FIRE           0x10
-#define LAUNCHER_STOP           0x20
-#define LAUNCHER_UP             0x02
-#define LAUNCHER_DOWN           0x01
-#define LAUNCHER_LEFT           0x04
-#define LAUNCHER_RIGHT          0x08
-#define LAUNCHER_UP_LEFT        (LAUNCHER_UP | LAUNCHER_LEFT)
-#define LAUNCHER_DOWN_LEFT      (LAUNCHER_DOWN | LAUNCHER_LEFT)
-#define LAUNCHER_UP_RIGHT       (LAUNCHER_UP | LAUNCHER_RIGHT)
-#define LAUNCHER_DOWN_RIGHT     (LAUNCHER_DOWN | LAUNCHER_RIGHT)
-
-#define DISP_WIDTH                 1920 // 15% = 288
-#define DISP_HEIGHT                1080 // 15% = 162
-#define BYTES_PER_PIX              2
-#define FRAME_BASE_ADDR            0x10000000
-#define FRAME_SIZE                 DISP_WIDTH * DISP_HEIGHT * BYTES_PER_PIX
+#include "sentry.h"
 
 #define FRAME_CENTER_X             960 
 #define FRAME_CENTER_Y             540 
-#define FRAME_CENTER_WIN_X         30         
-#define FRAME_CENTER_WIN_Y         30
-#define DELAY_MIN                  50
-#define DELAY_MAX                  250
-#define MAX_DIST_X                 (FRAME_CENTER_X - FRAME_CENTER_WIN_X)
-#define MAX_DIST_Y                 (FRAME_CENTER_Y - FRAME_CENTER_WIN_Y)
 
 volatile int *frame_data;
+static volatile sig_atomic_t stop_requested;
 
 
-typedef enum {
-    LEFT,
-    RIGHT,
-    UP,
-    DOWN
-} dir;
-
-static void launcher_cmd(int fd, int cmd) {
-  int retval = 0;
-  
-  retval = write(fd, &cmd, 1);
-  while (retval != 1) {
-    if (retval < 0) {
-      fprintf(stderr, "Could not send command to %s (error %d)\n", LAUNCHER_NODE, retval);
-    } 
-
-    else if (retval == 0) {
-      fprintf(stdout, "Command busy, waiting...\n");
+static double now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+// Full and coarse scan throughput with 1, 2 and all threads. Each line
+// gives the speed-up over one thread, and with the pool running splits the
+// frame time into the banded part, which the pool spreads across threads,
+// and the serial part around it (merging the bands, labeling, building the
+// coarse table), which no number of cores shortens.
+static void scan_benchmark(const classifier_t *c, const uint32_t *frame, int max_threads) {
+  static void (*const scans[2])(const classifier_t *, const uint32_t *, scan_result_t *) = {scan_full, scan_coarse};
+  static const char *const names[2] = {"full", "coarse"};
+  int counts[3] = {1, 2, max_threads};
+  double single[2] = {0, 0};
+  scan_result_t r;
+
+  for (int i = 0; i < 3; i++) {
+    int n;
+
+    if (i > 0 && counts[i] <= counts[i - 1]) {
+      continue;
+    }
+    n = scan_threads_start(counts[i]);
+    for (int k = 0; k < 2; k++) {
+      double t, banded;
+
+      scans[k](c, frame, &r);
+      scan_banded_time();
+      t = now_ms();
+      for (int f = 0; f < SCAN_BENCH_FRAMES; f++) {
+        scans[k](c, frame, &r);
+      }
+      t = (now_ms() - t) / SCAN_BENCH_FRAMES;
+      banded = scan_banded_time() / SCAN_BENCH_FRAMES;
+      single[k] = (n == 1) ? t : single[k];
+      printf("%-6s %d thread%s: %6.2f ms/frame, %6.1f Mpixel/s, %6.1f frames/s (%d hits), %4.2fx", names[k], n,
+             n > 1 ? "s" : " ", t, DISP_WIDTH * DISP_HEIGHT / (t * 1e3), 1e3 / t, r.count, single[k] / t);
+      if (n > 1) {
+        printf(", %5.2f ms banded + %5.2f ms serial", banded, t - banded);
+      }
+      printf("\n");
+    }
+  }
+  scan_threads_stop();
+}
+
+// Everything the detector keeps between frames
+typedef struct {
+  detect_mode_t detect;
+  classifier_t classifier;
+  motion_t motion;
+  matcher_t matcher;
+  hough_t hough;
+  scan_mode_t scan_mode;
+  int lock_on;
+  int follow;                   // Follow a locked target with CamShift
+  camshift_t camshift;
+  int follow_id;                // Track the CamShift model was taken from
+  int verbose;
+  int camera_moves;             // Turned by the launcher (not a recording)
+  frame_source_t source;
+  tracker_t tracker;
+  aim_ctrl_t aim;
+  double last_frame_ms;
+  scan_result_t scan;
+  const track_t *target;        // Aimed at in the last frame, or NULL
+  int mean_x, mean_y;           // Its offset from the frame center
+} sentry_t;
+
+// Scan one frame, update the tracks and decide what the launcher should do.
+// clock_ms is the frame's time (wall clock live, frame count on replay).
+static aim_cmd_t sentry_frame(sentry_t *s, const volatile uint32_t *map, double clock_ms) {
+  aim_cmd_t decision = {.type = AIM_STOP};
+  scan_result_t *scan = &s->scan;
+  const track_t *target;
+  const uint32_t *frame;
+  double aim_x, aim_y;
+  scan_window_t window;
+  int windowed;
+  int following;
+  int non_filtered_cnt = 0;
+  int mean_x;
+  int mean_y;
+  double scan_ms;
+  double dx = 0, dy = 0;
+  int64_t trace_t;
+
+  s->source.map = map;
+  // The launcher turning since the last frame has moved everything in the
+  // image; take that out so the tracks only follow the targets' own motion
+  if (s->camera_moves) {
+    aim_motion(&s->aim, s->last_frame_ms, clock_ms, &dx, &dy);
+    tracker_shift(&s->tracker, dx, dy);
+  }
+  scan_ms = now_ms();
+  trace_t = trace_now();
+  // With a target locked only the window around where it should be now
+  // is scanned. The window grows while the target is missed, and the
+  // full acquisition scan takes over once the track is dropped.
+  // With CamShift following it, the window is searched by the target's
+  // own colors instead.
+  target = s->lock_on ? tracker_target(&s->tracker) : NULL;
+  following = s->camshift.active && target != NULL && target->id == s->follow_id;
+  windowed = (s->detect == DETECT_COLOR || following) && target != NULL &&
+             track_window(target, (clock_ms - s->last_frame_ms) * 1e-3, &window);
+  // The coarse scan's reads are too sparse to be worth a snapshot
+  if (windowed && following) {
+    frame = frame_acquire(&s->source, &window);
+    track_predict(target, (clock_ms - s->last_frame_ms) * 1e-3, &aim_x, &aim_y);
+    memset(scan, 0, sizeof(*scan));
+    if (camshift_track(&s->camshift, frame, &window, aim_x, aim_y, &scan->blobs[0])) {
+      scan->nblobs = scan->components = 1;
+      scan->count = scan->blobs[0].area;
+      scan->x_sum = scan->blobs[0].x_sum;
+      scan->y_sum = scan->blobs[0].y_sum;
+    } else if (s->detect == DETECT_MOTION) {
+      // The background wasn't kept up while following
+      motion_reset(&s->motion);
+    }
+  } else if (s->detect == DETECT_MOTION) {
+    // Already reduced to a quarter of the rows and columns, so read in place.
+    // A turn of the launcher moves the whole background.
+    if (dx != 0 || dy != 0) {
+      motion_reset(&s->motion);
+    }
+    motion_scan(&s->motion, (const uint32_t *)map, scan);
+  } else if (s->detect == DETECT_TEMPLATE) {
+    // The pyramid reads every row, so it is worth the snapshot
+    frame = frame_acquire(&s->source, NULL);
+    template_scan(&s->matcher, frame, scan);
+  } else if (s->detect == DETECT_CIRCLE) {
+    frame = frame_acquire(&s->source, NULL);
+    hough_scan(&s->hough, frame, scan);
+  } else if (windowed) {
+    frame = frame_acquire(&s->source, &window);
+    scan_window(&s->classifier, frame, &window, scan);
+  } else if (s->scan_mode == SCAN_COARSE) {
+    scan_coarse(&s->classifier, (const uint32_t *)map, scan);
+  } else {
+    frame = frame_acquire(&s->source, NULL);
+    scan_full(&s->classifier, frame, scan);
+  }
+  non_filtered_cnt = scan->count;
+  scan_ms = now_ms() - scan_ms;
+  trace_span("scan", trace_t, "blobs", scan->nblobs);
+  trace_t = trace_now();
+  if (s->verbose) {
+    printf("----------------------------\n");
+    if (windowed && following) {
+      printf("non_filtered_cnt : %d (camshift %.1f ms, %d iterations, %.0fx%.0f at %.0f,%.0f)\n", non_filtered_cnt,
+             scan_ms, s->camshift.iterations, 2 * s->camshift.half_w, 2 * s->camshift.half_h,
+             s->camshift.cx, s->camshift.cy);
+    } else if (windowed) {
+      printf("non_filtered_cnt : %d (scan %.1f ms, window %dx%d at %d,%d)\n", non_filtered_cnt, scan_ms,
+             window.x1 - window.x0, window.y1 - window.y0, window.x0, window.y0);
+    } else {
+      printf("non_filtered_cnt : %d (scan %.1f ms, %d tiles)\n", non_filtered_cnt, scan_ms, scan->tiles);
+      if (s->detect == DETECT_TEMPLATE) {
+        printf("template match : %.2f over %d candidates\n", s->matcher.score, scan->components);
+      }
+      for (int i = 0; i < s->hough.ncircles && s->detect == DETECT_CIRCLE; i++) {
+        printf("circle : (%.1f, %.1f) radius %.1f, %d votes, %.0f%% of the edge (%d edge pixels)\n",
+               s->hough.circles[i].x, s->hough.circles[i].y, s->hough.circles[i].r, s->hough.circles[i].votes,
+               100 * s->hough.circles[i].support, s->hough.nedges);
+      }
+      if (scan->dense_hits > 0) {
+        printf("densest region : %d coarse hits in %dx%d at %d,%d\n", scan->dense_hits,
+               scan->dense.x1 - scan->dense.x0, scan->dense.y1 - scan->dense.y0, scan->dense.x0, scan->dense.y0);
+      }
+    }
+    printf("----------------------------\n");
+    printf("Making Decision..\n");
+  }
+  // Aim at a confirmed track rather than the raw blobs, so one noisy
+  // frame or a second green object can't swing the launcher around
+  tracker_update(&s->tracker, scan->blobs, scan->nblobs, (clock_ms - s->last_frame_ms) * 1e-3);
+  s->last_frame_ms = clock_ms;
+  s->target = target = tracker_target(&s->tracker);
+  // Take the colors of a newly confirmed target from the frame it was just
+  // seen in. This reads the whole frame, but only once per lock.
+  if (s->follow && s->lock_on && target != NULL && target->misses == 0 &&
+      !(s->camshift.active && target->id == s->follow_id)) {
+    scan_window_t box = {(int)target->x.pos - target->width / 2, (int)target->y.pos - target->height / 2,
+                         (int)target->x.pos + target->width / 2 + 1, (int)target->y.pos + target->height / 2 + 1};
+
+    frame = frame_acquire(&s->source, NULL);
+    if (camshift_lock(&s->camshift, frame, &box) == 0) {
+      s->follow_id = target->id;
+      if (s->verbose) {
+        printf("CamShift locked on track %d\n", target->id);
+      }
+    }
+  }
+  if(target != NULL){
+    // Predicted position, a little ahead to cover the command latency
+    track_predict(target, TRACK_LEAD_S, &aim_x, &aim_y);
+    mean_x = (int)aim_x;
+    mean_y = (int)aim_y;
+
+    // Mean value in relation to center of camera view
+    mean_x = mean_x - FRAME_CENTER_X;
+    mean_y = mean_y - FRAME_CENTER_Y;
+    s->mean_x = mean_x;
+    s->mean_y = mean_y;
+
+    if (s->verbose) {
+      printf("Target : (%d, %d), track %d, %d px of %d in %d blobs (%d rejected by shape)\n", mean_x, mean_y,
+             target->id, target->area, non_filtered_cnt, scan->components, scan->rejected);
+    }
+
+    // Fire once centered, otherwise move towards the center
+    decision = aim_update(&s->aim, target->x.pos - FRAME_CENTER_X, target->y.pos - FRAME_CENTER_Y,
+                          aim_x - FRAME_CENTER_X, aim_y - FRAME_CENTER_Y, clock_ms);
+    if (decision.type == AIM_MOVE && s->verbose) {
+      printf("Move Launcher\n");
+      printf("Direction is %s (%d ms pan, %d ms tilt)\n", launcher_cmd_name(decision.direction),
+             decision.pan_ms, decision.tilt_ms);
+    }
+  } else {
+    aim_reset(&s->aim);
+  }
+  trace_span("decide", trace_t, "type", decision.type);
+  return decision;
+}
+
+// Shape gate from "off" or a list like "area=16:50000,fill=0.5,ecc=0.9"
+static int parse_gate(const char *spec, shape_gate_t *g) {
+  char buf[128], *item, *save;
+
+  if (strcmp(spec, "off") == 0) {
+    *g = (shape_gate_t){0, 0, 0, 0};
+    return 0;
+  }
+  snprintf(buf, sizeof(buf), "%s", spec);
+  for (item = strtok_r(buf, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+    if (sscanf(item, "area=%d:%d", &g->min_area, &g->max_area) >= 1 ||
+        sscanf(item, "fill=%lf", &g->min_fill) == 1 ||
+        sscanf(item, "ecc=%lf", &g->max_eccentricity) == 1) {
+      continue;
+    }
+    return -1;
+  }
+  return 0;
+}
+
+static void on_sigint(int sig) {
+  (void)sig;
+  stop_requested = 1;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+// Run the detector over recorded frames as fast as it goes. The actuator
+// and launcher are scene_sim.c's, run on the clip's clock (REPLAY_FRAME_MS a
+// frame), so what the launcher receives depends only on the decisions.
+// Prints each frame's decision and latency, then the latency spread and the
+// commands the launcher received, by frame.
+static int replay_run(sentry_t *s, const char *path) {
+  sim_actuator_t act;
+  sim_launcher_t launcher;
+  uint32_t *frame;
+  double *latency;
+  double tick = 0;
+  struct stat st;
+  int nframes, shots = 0;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+    perror(path);
+    return -1;
+  }
+  nframes = st.st_size / FRAME_SIZE;
+  if (nframes == 0) {
+    fprintf(stderr, "%s holds no whole %dx%d 4:2:2 frame\n", path, DISP_WIDTH, DISP_HEIGHT);
+    return -1;
+  }
+  sim_actuator_init(&act);
+  sim_launcher_init(&launcher);
+  latency = malloc(nframes * sizeof(double));
+  launcher.log = malloc(SIM_LOG_LEN * sizeof(sim_log_t));
+  if (latency == NULL || launcher.log == NULL || posix_memalign((void **)&frame, 64, FRAME_SIZE) != 0) {
+    fprintf(stderr, "Out of memory\n");
+    return -1;
+  }
+
+  printf("Replaying %d frames from %s\n", nframes, path);
+  printf("frame     ms  decision     target\n");
+  for (int i = 0; i < nframes; i++) {
+    double clock_ms = i * REPLAY_FRAME_MS;
+    aim_cmd_t d;
+    double t;
+
+    int64_t trace_t = trace_now();
+
+    if (pread(fd, frame, FRAME_SIZE, (off_t)i * FRAME_SIZE) != FRAME_SIZE) {
+      perror("read frame");
+      break;
+    }
+    trace_span("read", trace_t, "frame", i);
+
+    // The actuator's timers up to this frame, on the clip's clock
+    launcher.frame = i;
+    for (; tick < clock_ms; tick += SIM_STEP_MS) {
+      sim_actuator_timers(&act, &launcher, tick);
+    }
+    t = now_ms();
+    d = sentry_frame(s, frame, clock_ms);
+    latency[i] = now_ms() - t;
+    sim_actuator_submit(&act, &launcher, &d, clock_ms);
+
+    printf("%5d %6.2f  %-5s %-5s", i, latency[i], aim_type_name(d.type),
+           d.type == AIM_MOVE ? launcher_cmd_name(d.direction) : "");
+    if (s->target != NULL) {
+      printf("  track %d at (%d, %d)", s->target->id, s->mean_x, s->mean_y);
     }
+    printf("\n");
+  }
+  // Let the last moves run out and any fire sequence finish
+  launcher.frame = nframes;
+  for (; act.fire_step != 0 || act.direction != 0; tick += SIM_STEP_MS) {
+    sim_actuator_timers(&act, &launcher, tick);
   }
 
+  qsort(latency, nframes, sizeof(double), cmp_double);
+  printf("Latency: min %.2f, median %.2f, p99 %.2f, max %.2f ms\n", latency[0], latency[nframes / 2],
+         latency[nframes * 99 / 100], latency[nframes - 1]);
 
-  if (cmd == LAUNCHER_FIRE) {
-    usleep(5000000);
+  printf("Launcher commands (frame, clip time):\n");
+  for (int i = 0; i < launcher.nlog; i++) {
+    printf("%5d %9.1f ms  %s\n", launcher.log[i].frame, launcher.log[i].ms, launcher_cmd_name(launcher.log[i].cmd));
+    shots += launcher.log[i].cmd == LAUNCHER_FIRE;
   }
+  printf("Launcher: %d commands, %d shots\n", launcher.nlog, shots);
+  free(launcher.log);
+  free(latency);
+  free(frame);
+  close(fd);
+  return 0;
 }
 
-void YCbCr_to_RGB(int YCbCr[3], int RGB[3]) {
-    int R, G, B;
+// Closed-loop benchmark. Each trial puts a moving target somewhere in view
+// and runs the sentry against the rendered scene and the virtual launcher
+// (scene_sim.c) until a dart leaves or SIM_MAX_FRAMES go by. A trial locks
+// on the first frame taken with the launcher stopped and the target really
+// inside the fire gate. Time is simulated, so the loop runs as fast as the
+// frames can be rendered and scanned. Both aim laws see the same targets.
+static int sim_run(sentry_t *s, int trials) {
+  static const aim_law_t laws[2] = {AIM_LAW_STEP, AIM_LAW_PID};
+  uint32_t target_word = sim_target_word(&s->classifier);
+  uint32_t *frame;
+  scene_t scene;
+  sim_launcher_t launcher;
+
+  if (target_word == 0) {
+    fprintf(stderr, "The classifier accepts no color\n");
+    return -1;
+  }
+  if (posix_memalign((void **)&frame, 64, FRAME_SIZE) != 0) {
+    fprintf(stderr, "Out of memory\n");
+    return -1;
+  }
+  if (scene_init(&scene, target_word) < 0) {
+    free(frame);
+    return -1;
+  }
 
-    R = YCbCr[0] + 1.402 * (YCbCr[2] - 128);
-    G = YCbCr[0] - 0.344136 * (YCbCr[1] - 128) - 0.714136 * (YCbCr[2] - 128);
-    B = YCbCr[0] + 1.772 * (YCbCr[1] - 128);
+  sim_launcher_init(&launcher);
+  printf("%d trials, target word %08X, motors at %.0f%% of the model, target up to %.1f deg/s, dart drop %.1f px\n",
+         trials, target_word, SIM_RATE_ERROR * 100, SIM_TARGET_SPEED, launcher.drop * SIM_PX_PER_DEG);
+  printf("law   locked  frames to lock  ms to lock  hits/shots  ms to shot  miss px  frames/s  x real time\n");
+  for (int law = 0; law < 2; law++) {
+    int locked = 0, shots = 0, hits = 0, frames = 0;
+    double lock_ms_sum = 0, shot_ms_sum = 0, miss_sum = 0, sim_ms = 0;
+    double start = now_ms();
+
+    srand(1);
+    for (int trial = 0; trial < trials; trial++) {
+      sim_actuator_t act;
+      double lock_ms = -1;
+
+      sim_launcher_init(&launcher);
+      sim_actuator_init(&act);
+      scene_place(&scene, &launcher);
+      tracker_init(&s->tracker);
+      aim_init(&s->aim, laws[law]);
+      motion_reset(&s->motion);
+      s->camshift.active = 0;
+      s->last_frame_ms = 0;
+      for (int i = 0; i < SIM_MAX_FRAMES; i++) {
+        double t = (i + 1) * REPLAY_FRAME_MS, miss;
+        aim_cmd_t d;
+
+        scene_render(&scene, &launcher, frame);
+        d = sentry_frame(s, frame, t);
+        frames++;
+        sim_ms += REPLAY_FRAME_MS;
+        if (lock_ms < 0 && sim_on_target(&scene, &launcher)) {
+          lock_ms = t;
+          locked++;
+          lock_ms_sum += t;
+        }
+        sim_actuator_submit(&act, &launcher, &d, t);
+        if (sim_advance(&scene, &act, &launcher, t, t + REPLAY_FRAME_MS, &miss)) {
+          shots++;
+          hits += (miss <= SIM_TARGET_RADIUS);
+          shot_ms_sum += t;
+          miss_sum += miss;
+          break;
+        }
+      }
+    }
 
-    // Clip the values
-    R = (R < 0) ? 0 : (R > 255) ? 255 : R;
-    G = (G < 0) ? 0 : (G > 255) ? 255 : G;
-    B = (B < 0) ? 0 : (B > 255) ? 255 : B;
+    double wall_ms = now_ms() - start;
+    printf("%-5s %3d/%-3d  %14.1f  %10.0f  %4d/%-5d  %10.0f  %7.1f  %8.1f  %11.1f\n", aim_law_name(laws[law]),
+           locked, trials, locked ? lock_ms_sum / locked / REPLAY_FRAME_MS : 0, locked ? lock_ms_sum / locked : 0, hits,
+           shots, shots ? shot_ms_sum / shots : 0,
+           shots ? miss_sum / shots : 0, frames / wall_ms * 1e3, sim_ms / wall_ms);
+  }
 
-    RGB[0] = R;
-    RGB[1] = G;
-    RGB[2] = B;
+  scene_free(&scene);
+  free(frame);
+  return 0;
 }
 
-int main() {
+int main(int argc, char *argv[]) {
   char c;
   int fd;
   int mem_fd;
   int *frame_ptr;
 
-  int cmd;
   char *dev = LAUNCHER_NODE;
-  unsigned int duration = 500;
+  static sentry_t sentry = {.scan_mode = SCAN_COARSE, .lock_on = 1, .verbose = 1, .camera_moves = 1};
+  classify_mode_t classify_mode = CLASSIFY_LUT;
+  char *cal_file = NULL;
+  char *template_spec = NULL;
+  char *rect_spec;
+  int min_radius = HOUGH_MIN_RADIUS, max_radius = HOUGH_MAX_RADIUS;
+  scan_window_t template_rect;
+  target_cal_t cal;
+  int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  int benchmark = 0;
+  char *frame_file = NULL;
+  frame_mode_t frame_mode = FRAME_SNAPSHOT;
+  char *replay_file = NULL;
+  char *trace_file = NULL;
+  aim_law_t aim_law = AIM_LAW_PID;
+  detect_mode_t detect_mode = DETECT_COLOR;
+  shape_gate_t gate = {BLOB_MIN_AREA, 0, SHAPE_MIN_FILL, SHAPE_MAX_ECCENTRICITY};
+  int sim_trials = 0;
+  const volatile uint32_t *map;
+  aim_cmd_t decision;
+  frame_sync_t sync;
+  actuator_t actuator;
+  int use_sync = 1;
+  int opt;
+  double t;
+
+  while ((opt = getopt(argc, argv, "a:bc:d:f:Fg:j:kl:m:np:r:R:s:S:t:T:v")) != -1) {
+    switch (opt) {
+      case 'a':
+        if (strcmp(optarg, "direct") == 0) {
+          frame_mode = FRAME_DIRECT;
+        } else if (strcmp(optarg, "snapshot") == 0) {
+          frame_mode = FRAME_SNAPSHOT;
+        } else {
+          fprintf(stderr, "Unknown frame access %s\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'b':
+        benchmark = 1;
+        break;
+      case 'c':
+        if (strcmp(optarg, "rgb") == 0) {
+          classify_mode = CLASSIFY_RGB;
+        } else if (strcmp(optarg, "lut") == 0) {
+          classify_mode = CLASSIFY_LUT;
+        } else if (strcmp(optarg, "ycc") == 0) {
+          classify_mode = CLASSIFY_YCC;
+        } else {
+          fprintf(stderr, "Unknown classifier %s\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'd':
+        if (strcmp(optarg, "color") == 0) {
+          detect_mode = DETECT_COLOR;
+        } else if (strcmp(optarg, "motion") == 0) {
+          detect_mode = DETECT_MOTION;
+        } else if (strcmp(optarg, "template") == 0) {
+          detect_mode = DETECT_TEMPLATE;
+        } else if (strcmp(optarg, "circle") == 0) {
+          detect_mode = DETECT_CIRCLE;
+        } else {
+          fprintf(stderr, "Unknown detector %s\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'f':
+        // Scan a raw 4:2:2 frame from a file instead of the frame buffer
+        frame_file = optarg;
+        break;
+      case 'F':
+        // Free-run: scan whatever is in the frame buffer, new or not
+        use_sync = 0;
+        break;
+      case 'g':
+        if (parse_gate(optarg, &gate) < 0) {
+          fprintf(stderr, "Bad shape gate %s\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'j':
+        // Record a Chrome trace of every frame and command until exit
+        trace_file = optarg;
+        break;
+      case 'k':
+        // Follow a locked target by its colors (CamShift) instead of
+        // rescanning its window with the detector
+        sentry.follow = 1;
+        break;
+      case 'l':
+        // Classify with a table made by target_calibrate
+        cal_file = optarg;
+        break;
+      case 'm':
+        // Coarse hits around a tile before it is classified in full
+        scan_set_density(atoi(optarg));
+        break;
+      case 'n':
+        // Always scan the whole frame, even with a target locked
+        sentry.lock_on = 0;
+        break;
+      case 'p':
+        if (strcmp(optarg, "pid") == 0) {
+          aim_law = AIM_LAW_PID;
+        } else if (strcmp(optarg, "step") == 0) {
+          aim_law = AIM_LAW_STEP;
+        } else {
+          fprintf(stderr, "Unknown aim law %s\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'r':
+        // Replay recorded frames on a host, with a mock launcher
+        replay_file = optarg;
+        break;
+      case 'R':
+        // Radius range for -d circle, full resolution pixels
+        if (sscanf(optarg, "%d:%d", &min_radius, &max_radius) != 2) {
+          fprintf(stderr, "Bad radius range %s\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 's':
+        if (strcmp(optarg, "full") == 0) {
+          sentry.scan_mode = SCAN_FULL;
+        } else if (strcmp(optarg, "coarse") == 0) {
+          sentry.scan_mode = SCAN_COARSE;
+        } else {
+          fprintf(stderr, "Unknown scan %s\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'S':
+        // Closed-loop benchmark on a rendered scene and a virtual launcher, then exit
+        sim_trials = atoi(optarg);
+        break;
+      case 't':
+        nthreads = atoi(optarg);
+        break;
+      case 'T':
+        // Pattern for -d template: a rectangle of the first frame of a
+        // recording, as frames.yuv:x0,y0,x1,y1
+        template_spec = optarg;
+        break;
+      case 'v':
+        // Prove the YCC classifier matches the RGB rule, the integral
+        // image and the CamShift moments match brute force, the motion
+        // background settles on a steady scene and drawn circles are
+        // found, then exit
+        exit(classifier_verify() == 0 && integral_verify() == 0 && camshift_verify() == 0 && motion_verify() == 0 &&
+                     hough_verify() == 0
+                 ? EXIT_SUCCESS
+                 : EXIT_FAILURE);
+      default:
+        fprintf(stderr, "Usage: %s [-a direct|snapshot] [-b] [-c rgb|lut|ycc] [-d color|motion|template|circle] [-f frame.yuv] [-F] [-g off|area=min:max,fill=f,ecc=e] [-j trace.json] [-k] [-l target.cal] [-m hits] [-n] [-p pid|step] [-r frames.yuv] [-R min:max] [-s full|coarse] [-S trials] [-t threads] [-T frames.yuv:x0,y0,x1,y1] [-v]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
 
   printf("Starting Sentry Application\n");
+  if (trace_file != NULL && trace_open(trace_file) < 0) {
+    exit(EXIT_FAILURE);
+  }
+  trace_thread_name("detector");
+
+  t = now_ms();
+  if (cal_file != NULL) {
+    if (classifier_load(&sentry.classifier, cal_file, &cal) < 0) {
+      fprintf(stderr, "Couldn't load classifier %s\n", cal_file);
+      exit(EXIT_FAILURE);
+    }
+    printf("Classifier %s: %u cells around Y %.0f Cb %.0f Cr %.0f\n", cal_file, cal.cells,
+           cal.mean[0], cal.mean[1], cal.mean[2]);
+  } else {
+    classifier_init(&sentry.classifier, classify_mode);
+    printf("Classifier %s ready in %.1f ms\n", classifier_name(classify_mode), now_ms() - t);
+  }
+  tracker_init(&sentry.tracker);
+  aim_init(&sentry.aim, aim_law);
+  sentry.detect = detect_mode;
+  if (detect_mode == DETECT_TEMPLATE) {
+    rect_spec = (template_spec != NULL) ? strrchr(template_spec, ':') : NULL;
+    if (rect_spec == NULL || sscanf(rect_spec + 1, "%d,%d,%d,%d", &template_rect.x0, &template_rect.y0,
+                                    &template_rect.x1, &template_rect.y1) != 4) {
+      fprintf(stderr, "-d template needs -T frames.yuv:x0,y0,x1,y1\n");
+      exit(EXIT_FAILURE);
+    }
+    *rect_spec = '\0';
+    if (template_load(&sentry.matcher, template_spec, &template_rect) < 0) {
+      exit(EXIT_FAILURE);
+    }
+    printf("Template %dx%d from %s, searched at 1/%d\n", sentry.matcher.width, sentry.matcher.height,
+           template_spec, 1 << sentry.matcher.coarse);
+  }
+  if (detect_mode == DETECT_CIRCLE) {
+    if (hough_init(&sentry.hough, min_radius, max_radius) < 0) {
+      exit(EXIT_FAILURE);
+    }
+    printf("Circles of radius %d to %d at 1/%d\n", min_radius, max_radius, 1 << HOUGH_LEVEL);
+  }
+  motion_reset(&sentry.motion);
+  printf("Detector: %s%s\n", detect_mode_name(detect_mode), sentry.follow ? ", CamShift after lock-on" : "");
+  scan_set_gate(&gate);
+  blob_set_gate(&sentry.motion.labeler, &gate);
+  printf("Shape gate: area %d to %d, fill >= %.2f, eccentricity <= %.2f (0 = no limit)\n",
+         gate.min_area, gate.max_area, gate.min_fill, gate.max_eccentricity);
+
+  if (sim_trials > 0) {
+    sentry.verbose = 0;
+    if (frame_source_init(&sentry.source, frame_mode, NULL) < 0) {
+      exit(EXIT_FAILURE);
+    }
+    scan_threads_start(nthreads);
+    if (sim_run(&sentry, sim_trials) < 0) {
+      exit(EXIT_FAILURE);
+    }
+    scan_threads_stop();
+    trace_close();
+    exit(EXIT_SUCCESS);
+  }
+
+  if (replay_file != NULL) {
+    sentry.verbose = 0;
+    sentry.camera_moves = 0;
+    if (frame_source_init(&sentry.source, frame_mode, NULL) < 0) {
+      exit(EXIT_FAILURE);
+    }
+    scan_threads_start(nthreads);
+    if (replay_run(&sentry, replay_file) < 0) {
+      exit(EXIT_FAILURE);
+    }
+    scan_threads_stop();
+    trace_close();
+    exit(EXIT_SUCCESS);
+  }
 
-  if ((mem_fd = open("/dev/mem", O_RDWR | O_SYNC)) < 0) {
-      perror("Couldn't open file /dev/mem");
+  if (frame_file != NULL) {
+    mem_fd = open(frame_file, O_RDONLY);
+  } else {
+    mem_fd = open("/dev/mem", O_RDWR | O_SYNC);
+  }
+  if (mem_fd < 0) {
+      perror(frame_file != NULL ? frame_file : "Couldn't open file /dev/mem");
       exit(EXIT_FAILURE);
   }
 
@@ -104,7 +713,7 @@ int main() {
       PROT_READ,              // Read-only access
       MAP_SHARED,             // Share with other processes
       mem_fd,                 // File descriptor for /dev/mem
-      FRAME_BASE_ADDR         // Offset to GPIO base address
+      frame_file != NULL ? 0 : FRAME_BASE_ADDR // Offset to GPIO base address
   );
 
   if (frame_ptr == MAP_FAILED) {
@@ -112,6 +721,28 @@ int main() {
       close(mem_fd);
       exit(EXIT_FAILURE);
   }
+
+  if (frame_file != NULL) {
+    use_sync = 0;
+  }
+  if (use_sync && frame_sync_open(&sync, mem_fd) < 0) {
+    fprintf(stderr, "Frame sync unavailable, free-running\n");
+    use_sync = 0;
+  }
+
+  if (frame_source_init(&sentry.source, frame_mode, (const volatile uint32_t *)frame_ptr) < 0) {
+    exit(EXIT_FAILURE);
+  }
+  printf("Frame access: %s\n", frame_mode_name(frame_mode));
+
+  if (benchmark) {
+    frame_benchmark(&sentry.source);
+    scan_benchmark(&sentry.classifier, frame_acquire(&sentry.source, NULL), nthreads);
+    exit(EXIT_SUCCESS);
+  }
+  nthreads = scan_threads_start(nthreads);
+  printf("Scanning with %d thread%s\n", nthreads, nthreads > 1 ? "s" : "");
+
   printf("Opening Launcher0 Device File\n");
   fd = open(dev, O_RDWR);
   if (fd == -1) {
@@ -121,28 +752,15 @@ int main() {
 
   frame_data = (volatile int *)(frame_ptr);
 
+  if (actuator_start(&actuator, fd) < 0) {
+    exit(EXIT_FAILURE);
+  }
+
 
   //Read Val
   //0xF0525A52;
   //[Cr][Y1][Cb][Y0]
   int pixel_data;
-  int pixel1_x;
-  int pixel2_x;
-  int pixel1_y;
-  int pixel2_y;
-  int Y1;
-  int Y0;
-  int Cb;
-  int Cr;
-  int non_filtered_cnt = 0;
-  int x_sum;
-  int y_sum;
-  int mean_x;
-  int mean_y;
-  dir nxt_dir = 0;
-  int YCbCr[3];
-  int RGB[3];
-  int stop_cmd_delay;
 
 
 
@@ -154,135 +772,42 @@ int main() {
   }
 
 
-  printf("Entering Processing Loop\n");
-  while(1){
-    non_filtered_cnt = 0;
-    x_sum = 0;
-    y_sum = 0;
-    // Loop over all pixels
-    for (int row = 0; row < DISP_HEIGHT; row++) {
-      for (int col = 0; col < DISP_WIDTH / 2; col++) {
-        // Calculate the offset for the current pixel
-        int offset = (row * (DISP_WIDTH / 2)) + col;
-        //printf("Offset %d\n", offset);
-        // Access the pixel data using frame_data[offset]
-        pixel_data = frame_data[offset];
-        //printf("Pixel Data %X\n", pixel_data);
-        pixel1_x = (col * 2);
-        pixel2_x = (col * 2) + 1;
-        pixel1_y = row;
-        pixel2_y = row;
-
-
-        //printf("About to extract YCbCr Values");
-        // Extract Y, Cb, and Cr values for each pixel
-        YCbCr[2] = (pixel_data >> 24) & 0xFF;  // Cr value (shared for both pixels)
-        Y1 = (pixel_data >> 16) & 0xFF;  // Y value for the first pixel
-        YCbCr[1] = (pixel_data >> 8) & 0xFF;   // Cb value (shared for both pixels)
-        Y0 = pixel_data & 0xFF;          // Y value for the second pixel
-        
-        YCbCr[0] = Y0;
-        YCbCr_to_RGB(YCbCr, RGB);
-
-        // Center Green  R - 41, G - 92, B - 39
-        // Boundary Green (Light) R - 25, G - 200, B - 17
-        // Boundary Green (Dark) R - 43, G - 66, B - 50
-
-
-        if((RGB[0] > 25 && RGB[0] < 43) && (RGB[1] > 66 && RGB[1] < 200) && (RGB[2] > 17 && RGB[2] < 50)){
-          //printf("RGB: %02X, %02X, %02X\n", RGB[0], RGB[1], RGB[2]);
-          //printf("Pixel Passed\n");
-          //printf("pixel1 location (%d, %d)\n", pixel1_x - FRAME_CENTER_X, pixel1_y - FRAME_CENTER_Y);
-          non_filtered_cnt++;
-          x_sum += pixel1_x;
-          y_sum += pixel1_y;
-        }
-        
-        YCbCr[1] = Y0;
-        YCbCr_to_RGB(YCbCr, RGB);
-        
-        if((RGB[0] > 25 && RGB[0] < 43) && (RGB[1] > 66 && RGB[1] < 200) && (RGB[2] > 17 && RGB[2] < 50)){
-          non_filtered_cnt++;
-          x_sum += pixel2_x;
-          y_sum += pixel2_y;
-        }
+  sentry.last_frame_ms = now_ms();
+  map = (const volatile uint32_t *)frame_ptr;
 
+  // Ctrl-C stops the launcher and writes out the trace
+  signal(SIGINT, on_sigint);
+  printf("Entering Processing Loop\n");
+  while (!stop_requested) {
+    // Every decision is made on exactly one new, complete frame
+    if (use_sync) {
+      int64_t trace_t = trace_now();
+
+      map = frame_sync_wait(&sync);
+      trace_span("frame wait", trace_t, "new", map != NULL);
+      if (map == NULL) {
+        printf("No new frame from the VDMA\n");
+        continue;
       }
     }
-    printf("----------------------------\n");
-    printf("non_filtered_cnt : %d\n", non_filtered_cnt);
-    printf("----------------------------\n");
-    printf("Making Decision..\n");
-    if(non_filtered_cnt > 0){
-      // Find mean value
-      mean_x = (int)(x_sum / non_filtered_cnt);
-      mean_y = (int)(y_sum / non_filtered_cnt);
-
-      // Mean value in relation to center of camera view
-      mean_x = mean_x - FRAME_CENTER_X;
-      mean_y = mean_y - FRAME_CENTER_Y;
-
-      printf("Target : (%d, %d)\n", mean_x, mean_y);
-
-      // Determine Launcher Direction
-      if((mean_x * mean_x) > (mean_y*mean_y)){
-        nxt_dir = (mean_x > 0)? RIGHT:LEFT;
-        stop_cmd_delay = (int)(abs(mean_x) / MAX_DIST_X) * DELAY_MAX;
-      }else{
-        nxt_dir = (mean_y > 0)? DOWN:UP;
-        stop_cmd_delay = (int)(abs(mean_y) / MAX_DIST_Y) * DELAY_MAX;
-      }
-
-
-      // Check if close enough to center, otherwise move in direction given by nxt_dir
-      if((mean_x * mean_x) < (FRAME_CENTER_WIN_X * FRAME_CENTER_WIN_X) && (mean_y * mean_y) < (FRAME_CENTER_WIN_Y * FRAME_CENTER_WIN_Y)){
-        // Stop Moving & Fire
-        printf("Stop & Fire\n");
-        launcher_cmd(fd, LAUNCHER_STOP);
-        launcher_cmd(fd, LAUNCHER_UP);
-        usleep((125) * 1000);
-        launcher_cmd(fd, LAUNCHER_STOP);
-        usleep(duration * 1000); 
-        launcher_cmd(fd, LAUNCHER_FIRE);
-        usleep(duration * 1000); 
-
-      }else{
-        // Move Launcher
-        printf("Move Launcher %d\n", nxt_dir);
-        switch (nxt_dir) {
-            case LEFT:
-                printf("Direction is LEFT\n");
-                cmd = LAUNCHER_LEFT;
-                break;
-            case RIGHT:
-                printf("Direction is RIGHT\n");
-                cmd = LAUNCHER_RIGHT;
-                break;
-            case UP:
-                printf("Direction is UP\n");
-                cmd = LAUNCHER_UP;
-                break;
-            case DOWN:
-                printf("Direction is DOWN\n");
-                cmd = LAUNCHER_DOWN;
-                break;
-        }
 
-        launcher_cmd(fd, cmd);
-        usleep(((stop_cmd_delay > DELAY_MIN)? stop_cmd_delay:DELAY_MIN) * 1000);
-        launcher_cmd(fd, LAUNCHER_STOP);
-      }
-    }else{
-      launcher_cmd(fd, LAUNCHER_STOP);
-    }
+    // The actuator thread carries the decision out; detection goes straight
+    // on to the next frame
+    decision = sentry_frame(&sentry, map, now_ms());
+    actuator_submit(&actuator, &decision);
   }
 
   printf("Exiting..\n");
   //launcher_cmd(fd, cmd);
   //usleep(duration * 1000); 
 
+  actuator_stop(&actuator);
   launcher_cmd(fd, LAUNCHER_STOP);
-
+  scan_threads_stop();
+  trace_close();
+  if (use_sync) {
+    frame_sync_close(&sync);
+  }
 
 
   close(mem_fd);
@@ -0,0 +1,206 @@
+// motion_detect.c - find moving objects by background subtraction.
+//
+// The Y plane is sampled every MOTION_STEP pixels in both directions (Y0 of
+// every other word on every fourth row) into bytes. The background is an
+// exponential average of those samples with weight 1/8, kept in 16 bits
+// with MOTION_BG_FRAC fraction bits and updated with a shift, so it settles
+// on a steady scene from either side; a sample that differs from it, rounded
+// to a byte, by more than MOTION_THRESHOLD is foreground. Both steps work on
+// 16 samples at a time with NEON or SSE2. Foreground cells are labeled as
+// MOTION_STEP x MOTION_STEP blocks of full-resolution pixels, so the blobs
+// feed the tracker like the color detector's.
+//
+// The background only means something while the camera is still: the
+// sentry resets it whenever the launcher turns.
+
+#include <stdio.h>
+#include <string.h>
+#include "sentry.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MOTION_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define MOTION_SSE2
+#endif
+
+const char *detect_mode_name(detect_mode_t mode) {
+  switch (mode) {
+    case DETECT_COLOR:    return "color";
+    case DETECT_MOTION:   return "motion";
+    case DETECT_TEMPLATE: return "template";
+    case DETECT_CIRCLE:   return "circle";
+  }
+  return "?";
+}
+
+void motion_reset(motion_t *m) {
+  m->frames = 0;
+}
+
+// Y0 of every other word: one sample every MOTION_STEP pixels
+static void motion_sample_row(const uint32_t *src, uint8_t *y) {
+  for (int i = 0; i < MOTION_COLS; i++) {
+    y[i] = pix422_y0(src[i * (MOTION_STEP / 2)]);
+  }
+}
+
+// Flag the samples that differ from the background, then fold them in:
+// bg += (y - bg) / 8 in fixed point. The shift rounds down, so from above
+// the background reaches y exactly and from below it stops less than half
+// a level short, which rounds to y.
+static void motion_update_scalar(uint16_t *bg, const uint8_t *y, uint8_t *fg, int n) {
+  for (int i = 0; i < n; i++) {
+    int b = (bg[i] + (1 << (MOTION_BG_FRAC - 1))) >> MOTION_BG_FRAC;
+    int d = (y[i] > b) ? y[i] - b : b - y[i];
+
+    fg[i] = d > MOTION_THRESHOLD;
+    bg[i] += ((y[i] << MOTION_BG_FRAC) - bg[i]) >> 3;
+  }
+}
+
+#if defined(MOTION_NEON)
+static void motion_update_row(uint16_t *bg, const uint8_t *y, uint8_t *fg) {
+  const uint8x16_t thr = vdupq_n_u8(MOTION_THRESHOLD);
+  const uint8x16_t one = vdupq_n_u8(1);
+  int i;
+
+  for (i = 0; i + 16 <= MOTION_COLS; i += 16) {
+    int16x8_t lo = vreinterpretq_s16_u16(vld1q_u16(bg + i));
+    int16x8_t hi = vreinterpretq_s16_u16(vld1q_u16(bg + i + 8));
+    uint8x16_t v = vld1q_u8(y + i);
+    uint8x16_t b = vcombine_u8(vqrshrun_n_s16(lo, MOTION_BG_FRAC), vqrshrun_n_s16(hi, MOTION_BG_FRAC));
+    int16x8_t vlo = vreinterpretq_s16_u16(vshll_n_u8(vget_low_u8(v), MOTION_BG_FRAC));
+    int16x8_t vhi = vreinterpretq_s16_u16(vshll_n_u8(vget_high_u8(v), MOTION_BG_FRAC));
+
+    vst1q_u8(fg + i, vandq_u8(vcgtq_u8(vabdq_u8(v, b), thr), one));
+    vst1q_u16(bg + i, vreinterpretq_u16_s16(vsraq_n_s16(lo, vsubq_s16(vlo, lo), 3)));
+    vst1q_u16(bg + i + 8, vreinterpretq_u16_s16(vsraq_n_s16(hi, vsubq_s16(vhi, hi), 3)));
+  }
+  motion_update_scalar(bg + i, y + i, fg + i, MOTION_COLS - i);
+}
+#elif defined(MOTION_SSE2)
+static void motion_update_row(uint16_t *bg, const uint8_t *y, uint8_t *fg) {
+  const __m128i thr = _mm_set1_epi8(MOTION_THRESHOLD);
+  const __m128i one = _mm_set1_epi8(1);
+  const __m128i half = _mm_set1_epi16(1 << (MOTION_BG_FRAC - 1));
+  const __m128i zero = _mm_setzero_si128();
+  int i;
+
+  for (i = 0; i + 16 <= MOTION_COLS; i += 16) {
+    __m128i lo = _mm_loadu_si128((const __m128i *)(bg + i));
+    __m128i hi = _mm_loadu_si128((const __m128i *)(bg + i + 8));
+    __m128i v = _mm_loadu_si128((const __m128i *)(y + i));
+    __m128i b = _mm_packus_epi16(_mm_srli_epi16(_mm_add_epi16(lo, half), MOTION_BG_FRAC),
+                                 _mm_srli_epi16(_mm_add_epi16(hi, half), MOTION_BG_FRAC));
+    __m128i vlo = _mm_slli_epi16(_mm_unpacklo_epi8(v, zero), MOTION_BG_FRAC);
+    __m128i vhi = _mm_slli_epi16(_mm_unpackhi_epi8(v, zero), MOTION_BG_FRAC);
+    __m128i d = _mm_or_si128(_mm_subs_epu8(v, b), _mm_subs_epu8(b, v));
+    // d > thr exactly when d - thr (saturating) is not zero
+    __m128i over = _mm_cmpeq_epi8(_mm_subs_epu8(d, thr), zero);
+
+    _mm_storeu_si128((__m128i *)(fg + i), _mm_andnot_si128(over, one));
+    _mm_storeu_si128((__m128i *)(bg + i), _mm_add_epi16(lo, _mm_srai_epi16(_mm_sub_epi16(vlo, lo), 3)));
+    _mm_storeu_si128((__m128i *)(bg + i + 8), _mm_add_epi16(hi, _mm_srai_epi16(_mm_sub_epi16(vhi, hi), 3)));
+  }
+  motion_update_scalar(bg + i, y + i, fg + i, MOTION_COLS - i);
+}
+#else
+static void motion_update_row(uint16_t *bg, const uint8_t *y, uint8_t *fg) {
+  motion_update_scalar(bg, y, fg, MOTION_COLS);
+}
+#endif
+
+// Update the background from one frame and label what stands out from it.
+// The first frame after a reset becomes the background, and nothing is
+// reported until MOTION_WARMUP frames have gone into it.
+void motion_scan(motion_t *m, const uint32_t *frame, scan_result_t *r) {
+  uint8_t y[MOTION_COLS], fg[MOTION_COLS];
+  int run_x0[MOTION_COLS / 2 + 1], run_x1[MOTION_COLS / 2 + 1];
+  int nruns;
+  int report = m->frames >= MOTION_WARMUP;
+
+  memset(r, 0, sizeof(*r));
+  blob_begin(&m->labeler);
+
+  for (int row = 0; row < MOTION_ROWS; row++) {
+    const uint32_t *src = &frame[row * MOTION_STEP * FRAME_WORDS_PER_ROW];
+
+    motion_sample_row(src, y);
+    if (m->frames == 0) {
+      for (int i = 0; i < MOTION_COLS; i++) {
+        m->bg[row][i] = y[i] << MOTION_BG_FRAC;
+      }
+      continue;
+    }
+    motion_update_row(m->bg[row], y, fg);
+    if (!report) {
+      continue;
+    }
+
+    // Each foreground run covers MOTION_STEP rows of full-resolution pixels
+    nruns = 0;
+    for (int i = 0; i < MOTION_COLS; i++) {
+      if (!fg[i]) {
+        continue;
+      }
+      run_x0[nruns] = i * MOTION_STEP;
+      while (i + 1 < MOTION_COLS && fg[i + 1]) {
+        i++;
+      }
+      run_x1[nruns++] = i * MOTION_STEP + MOTION_STEP - 1;
+    }
+    for (int k = 0; k < MOTION_STEP; k++) {
+      int y0 = row * MOTION_STEP + k;
+
+      for (int j = 0; j < nruns; j++) {
+        int len = run_x1[j] - run_x0[j] + 1;
+
+        blob_add_run(&m->labeler, y0, run_x0[j], run_x1[j]);
+        r->count += len;
+        r->x_sum += (int64_t)(run_x0[j] + run_x1[j]) * len / 2;
+        r->y_sum += (int64_t)y0 * len;
+      }
+    }
+  }
+
+  m->frames++;
+  r->nblobs = blob_end(&m->labeler, r->blobs, BLOB_MAX);
+  r->components = m->labeler.components;
+  r->rejected = m->labeler.rejected;
+}
+
+// Hold every sample level steady against a background started at every
+// other level, for long enough to settle, and check the background lands on
+// it exactly in both the scalar and the vector update, with no foreground
+// left. Returns the number of samples that didn't.
+long motion_verify(void) {
+  static uint16_t bg[256][MOTION_COLS], bg_ref[256][MOTION_COLS];
+  uint8_t y[MOTION_COLS], fg[MOTION_COLS], fg_ref[MOTION_COLS];
+  long errors = 0;
+
+  for (int from = 0; from < 256; from++) {
+    for (int i = 0; i < MOTION_COLS; i++) {
+      bg[from][i] = bg_ref[from][i] = (uint16_t)(from << MOTION_BG_FRAC);
+    }
+  }
+  for (int i = 0; i < MOTION_COLS; i++) {
+    y[i] = i % 256;
+  }
+  for (int frame = 0; frame < MOTION_VERIFY_FRAMES; frame++) {
+    for (int from = 0; from < 256; from++) {
+      motion_update_row(bg[from], y, fg);
+      motion_update_scalar(bg_ref[from], y, fg_ref, MOTION_COLS);
+      errors += memcmp(fg, fg_ref, MOTION_COLS) != 0;
+      errors += memcmp(bg[from], bg_ref[from], sizeof(bg[from])) != 0;
+    }
+  }
+  for (int from = 0; from < 256; from++) {
+    for (int i = 0; i < MOTION_COLS; i++) {
+      errors += ((bg_ref[from][i] + (1 << (MOTION_BG_FRAC - 1))) >> MOTION_BG_FRAC) != y[i] || fg_ref[i];
+    }
+  }
+  printf("Verified motion background over %d levels from every start: %ld mismatches\n", 256, errors);
+  return errors;
+}
@@ -0,0 +1,308 @@
+// scene_sim.c - a range and a launcher in software, for closed-loop runs
+// of the sentry on a host (launcher_fire_camera -S).
+//
+// The scene is a textured backdrop fixed in the world and a green disc
+// drifting across it, both placed by bearing and elevation. The camera
+// sits on the launcher, so each frame is rendered from where the launcher
+// points: the backdrop is copied out of a pre-shifted tile a row at a time,
+// and the disc is drawn over it.
+//
+// The launcher takes the same LAUNCHER_* bytes as the USB one. Each axis
+// spins up to its slew rate, coasts down when stopped and stays within
+// its travel; FIRE lets the dart go SIM_FIRE_DELAY_MS later, aimed where
+// the launcher points then, less the dart's drop. The drop is what the
+// fire sequence's raise gives on this launcher, spin-up, coast and all. Aim commands reach it the
+// way the actuator thread would send them: each axis runs for its own time,
+// and a fire sequence (raise, settle, fire, reload) ignores commands until
+// it is done. Everything runs on simulated time, in SIM_STEP_MS steps, so a
+// run goes as fast as the detector does.
+//
+// Replays (launcher_fire_camera -r) use the actuator and launcher alone, on
+// the clip's clock, and record the commands the launcher receives. The
+// record depends only on the detector's decisions, so runs can be diffed.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sentry.h"
+
+#define SIM_FIRE_SEQUENCE_MS       (ACT_FIRE_RAISE_MS + ACT_FIRE_SETTLE_MS + ACT_FIRE_RELOAD_MS)
+
+// A color the classifier accepts, from the middle of the ones it accepts
+uint32_t sim_target_word(const classifier_t *c) {
+  uint32_t words[128];
+  uint8_t mask[256];
+  int pass, n = 0, seen = 0;
+
+  for (pass = 0; pass < 2; pass++) {
+    for (int Cb = 0; Cb < 256; Cb += 2) {
+      for (int Cr = 0; Cr < 256; Cr += 2) {
+        for (int Y = 0; Y < 256; Y += 2) {
+          words[Y / 2] = pix422_word(Y, Cb, Y, Cr);
+        }
+        c->classify_row(c, words, 128, mask);
+        for (int i = 0; i < 128; i++) {
+          if (mask[2 * i] && pass == 1 && seen++ == n / 2) {
+            return words[i];
+          }
+          n += (pass == 0 && mask[2 * i]);
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+// Backdrop: a low contrast checkerboard with a little fixed grain, grey so
+// no classifier takes it for the target
+int scene_init(scene_t *sc, uint32_t target_word) {
+  const int words = (DISP_WIDTH + SIM_TILE) / 2;
+
+  memset(sc, 0, sizeof(*sc));
+  sc->target_word = target_word;
+  sc->tile = malloc(SIM_TILE * words * sizeof(uint32_t));
+  if (sc->tile == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    return -1;
+  }
+  srand(2);
+  for (int row = 0; row < SIM_TILE; row++) {
+    for (int i = 0; i < words; i++) {
+      int x = (2 * i) % SIM_TILE;
+      int y = ((x < SIM_TILE / 2) == (row < SIM_TILE / 2)) ? 176 : 192;
+
+      sc->tile[row * words + i] = pix422_word(y + rand() % 8, 128, y + rand() % 8, 128);
+    }
+  }
+  return 0;
+}
+
+void scene_free(scene_t *sc) {
+  free(sc->tile);
+  sc->tile = NULL;
+}
+
+// Put the target somewhere in view of the launcher, moving in a random
+// direction at up to SIM_TARGET_SPEED. Nothing below the launcher's lowest
+// tilt, which it could never aim at.
+void scene_place(scene_t *sc, const sim_launcher_t *l) {
+  double ex = (rand() % (DISP_WIDTH - 4 * SIM_TARGET_RADIUS)) - (DISP_WIDTH / 2 - 2 * SIM_TARGET_RADIUS);
+  double ey = (rand() % (DISP_HEIGHT - 4 * SIM_TARGET_RADIUS)) - (DISP_HEIGHT / 2 - 2 * SIM_TARGET_RADIUS);
+  double speed = SIM_TARGET_SPEED / 1e3 * (rand() % 1001) / 1000;
+  double heading = 2 * M_PI * (rand() % 360) / 360;
+
+  sc->x = sc->x0 = l->pan.pos + ex / SIM_PX_PER_DEG;
+  sc->y = sc->y0 = l->tilt.pos - ey / SIM_PX_PER_DEG;
+  if (sc->y < SIM_TILT_MIN_DEG) {
+    sc->y = sc->y0 = 2 * SIM_TILT_MIN_DEG - sc->y;
+  }
+  sc->vx = speed * cos(heading);
+  sc->vy = speed * sin(heading);
+}
+
+// What the camera sees with the launcher where it is now
+void scene_render(const scene_t *sc, const sim_launcher_t *l, uint32_t *frame) {
+  const int words = (DISP_WIDTH + SIM_TILE) / 2;
+  // World pixel of the frame's top left corner; the backdrop moves in whole pairs
+  int wx = (int)floor(l->pan.pos * SIM_PX_PER_DEG) - DISP_WIDTH / 2;
+  int wy = (int)floor(-l->tilt.pos * SIM_PX_PER_DEG) - DISP_HEIGHT / 2;
+  int ox = ((wx % SIM_TILE) + SIM_TILE) % SIM_TILE / 2;
+  double cx = DISP_WIDTH / 2 + (sc->x - l->pan.pos) * SIM_PX_PER_DEG;
+  double cy = DISP_HEIGHT / 2 - (sc->y - l->tilt.pos) * SIM_PX_PER_DEG;
+  int r = SIM_TARGET_RADIUS;
+
+  for (int row = 0; row < DISP_HEIGHT; row++) {
+    int ty = (((wy + row) % SIM_TILE) + SIM_TILE) % SIM_TILE;
+
+    memcpy(&frame[row * FRAME_WORDS_PER_ROW], &sc->tile[ty * words + ox], FRAME_WORDS_PER_ROW * sizeof(uint32_t));
+  }
+  for (int row = (int)cy - r; row <= (int)cy + r; row++) {
+    if (row < 0 || row >= DISP_HEIGHT) {
+      continue;
+    }
+    for (int col = ((int)cx - r) & ~1; col <= (int)cx + r; col += 2) {
+      double dx = col - cx, dy = row - cy;
+
+      if (col >= 0 && col < DISP_WIDTH && dx * dx + dy * dy <= r * r) {
+        frame[row * FRAME_WORDS_PER_ROW + col / 2] = sc->target_word;
+      }
+    }
+  }
+}
+
+// Target motion, turning back at the edge of its range or the lowest tilt
+static void scene_step(scene_t *sc, double dt) {
+  sc->x += sc->vx * dt;
+  sc->y += sc->vy * dt;
+  if (fabs(sc->x - sc->x0) > SIM_TARGET_RANGE) {
+    sc->vx = -sc->vx;
+  }
+  if (fabs(sc->y - sc->y0) > SIM_TARGET_RANGE || (sc->y < SIM_TILT_MIN_DEG && sc->vy < 0)) {
+    sc->vy = -sc->vy;
+  }
+}
+
+// Speed up towards the driven speed over SIM_SPINUP_MS, slow down over
+// SIM_COAST_MS, and stop dead at the end of travel
+static void sim_axis_step(sim_axis_t *ax, double dt) {
+  double goal = ax->drive * ax->rate;
+  int faster = fabs(goal) > fabs(ax->vel) && goal * ax->vel >= 0;
+  double dv = ax->rate / (faster ? SIM_SPINUP_MS : SIM_COAST_MS) * dt;
+  double v = ax->vel;
+
+  ax->vel = (goal > v) ? fmin(v + dv, goal) : fmax(v - dv, goal);
+  // Steps of rate / SIM_COAST_MS don't quite come to zero in doubles
+  if (fabs(ax->vel - goal) < 1e-12) {
+    ax->vel = goal;
+  }
+  ax->pos += (v + ax->vel) / 2 * dt;
+  if (ax->pos <= ax->min || ax->pos >= ax->max) {
+    ax->pos = (ax->pos <= ax->min) ? ax->min : ax->max;
+    ax->vel = 0;
+  }
+}
+
+// How far the fire sequence's ACT_FIRE_RAISE_MS of UP turns an axis at rest
+static double sim_raise(sim_axis_t ax) {
+  double t;
+
+  ax.pos = ax.vel = 0;
+  ax.min = -1e9;
+  ax.max = 1e9;
+  ax.drive = 1;
+  for (t = 0; t < ACT_FIRE_RAISE_MS; t += SIM_STEP_MS) {
+    sim_axis_step(&ax, SIM_STEP_MS);
+  }
+  ax.drive = 0;
+  while (ax.vel != 0) {
+    sim_axis_step(&ax, SIM_STEP_MS);
+  }
+  return ax.pos;
+}
+
+void sim_launcher_init(sim_launcher_t *l) {
+  l->pan = (sim_axis_t){0, 0, 0, AIM_PAN_PX_PER_MS * SIM_RATE_ERROR / SIM_PX_PER_DEG, SIM_PAN_MIN_DEG,
+                        SIM_PAN_MAX_DEG};
+  l->tilt = (sim_axis_t){0, 0, 0, AIM_TILT_PX_PER_MS * SIM_RATE_ERROR / SIM_PX_PER_DEG, SIM_TILT_MIN_DEG,
+                         SIM_TILT_MAX_DEG};
+  l->fire_at = 0;
+  l->drop = sim_raise(l->tilt);
+  l->shots = 0;
+  l->frame = 0;
+  l->log = NULL;
+  l->nlog = 0;
+}
+
+// One USB command. A direction replaces whatever both axes were doing.
+void sim_launcher_cmd(sim_launcher_t *l, int cmd, double t) {
+  if (l->log != NULL && l->nlog < SIM_LOG_LEN) {
+    l->log[l->nlog++] = (sim_log_t){l->frame, t, cmd};
+  }
+  if (cmd == LAUNCHER_FIRE) {
+    if (l->fire_at == 0) {
+      l->fire_at = t + SIM_FIRE_DELAY_MS;
+    }
+    return;
+  }
+  if (cmd == LAUNCHER_STOP) {
+    l->pan.drive = l->tilt.drive = 0;
+    return;
+  }
+  l->pan.drive = (cmd & LAUNCHER_RIGHT) ? 1 : (cmd & LAUNCHER_LEFT) ? -1 : 0;
+  l->tilt.drive = (cmd & LAUNCHER_UP) ? 1 : (cmd & LAUNCHER_DOWN) ? -1 : 0;
+}
+
+void sim_actuator_init(sim_actuator_t *a) {
+  memset(a, 0, sizeof(*a));
+}
+
+// Send only when the running axes change, as the actuator does
+static void sim_actuator_steer(sim_actuator_t *a, sim_launcher_t *l, int direction, double t) {
+  if (direction != a->direction) {
+    sim_launcher_cmd(l, direction ? direction : LAUNCHER_STOP, t);
+    a->direction = direction;
+  }
+}
+
+// A decision from the detector at time t
+void sim_actuator_submit(sim_actuator_t *a, sim_launcher_t *l, const aim_cmd_t *c, double t) {
+  if (a->fire_step != 0) {
+    return;
+  }
+  switch (c->type) {
+    case AIM_STOP:
+      sim_actuator_steer(a, l, 0, t);
+      break;
+    case AIM_MOVE:
+      a->pan_until = t + c->pan_ms;
+      a->tilt_until = t + c->tilt_ms;
+      sim_actuator_steer(a, l, c->direction, t);
+      break;
+    case AIM_FIRE:
+      sim_launcher_cmd(l, LAUNCHER_STOP, t);
+      sim_launcher_cmd(l, LAUNCHER_UP, t);
+      a->direction = LAUNCHER_UP;
+      a->fire_start = t;
+      a->fire_step = 2;
+      break;
+  }
+}
+
+// The rest of a fire sequence, or the end of each axis' run
+void sim_actuator_timers(sim_actuator_t *a, sim_launcher_t *l, double t) {
+  int direction = a->direction;
+
+  if (a->fire_step != 0) {
+    if (a->fire_step == 2 && t >= a->fire_start + ACT_FIRE_RAISE_MS) {
+      sim_launcher_cmd(l, LAUNCHER_STOP, t);
+      a->direction = 0;
+      a->fire_step++;
+    }
+    if (a->fire_step == 3 && t >= a->fire_start + ACT_FIRE_RAISE_MS + ACT_FIRE_SETTLE_MS) {
+      sim_launcher_cmd(l, LAUNCHER_FIRE, t);
+      a->fire_step++;
+    }
+    if (t >= a->fire_start + SIM_FIRE_SEQUENCE_MS) {
+      a->fire_step = 0;
+    }
+    return;
+  }
+  if (t >= a->pan_until) {
+    direction &= ~(LAUNCHER_LEFT | LAUNCHER_RIGHT);
+  }
+  if (t >= a->tilt_until) {
+    direction &= ~(LAUNCHER_UP | LAUNCHER_DOWN);
+  }
+  sim_actuator_steer(a, l, direction, t);
+}
+
+// Whether the launcher stands still pointing where the aim controller
+// would fire, by where the target really is
+int sim_on_target(const scene_t *sc, const sim_launcher_t *l) {
+  return l->pan.vel == 0 && l->tilt.vel == 0 &&
+         aim_in_gate((sc->x - l->pan.pos) * SIM_PX_PER_DEG, -(sc->y - l->tilt.pos) * SIM_PX_PER_DEG);
+}
+
+// Run the world from t0 to t1. Returns 1 if a dart left on the way, with
+// how far from the target's center it went, in pixels at the camera.
+int sim_advance(scene_t *sc, sim_actuator_t *a, sim_launcher_t *l, double t0, double t1, double *miss_px) {
+  for (double t = t0; t < t1; t += SIM_STEP_MS) {
+    double dt = (t + SIM_STEP_MS < t1) ? SIM_STEP_MS : t1 - t;
+
+    sim_actuator_timers(a, l, t);
+    sim_axis_step(&l->pan, dt);
+    sim_axis_step(&l->tilt, dt);
+    scene_step(sc, dt);
+    if (l->fire_at != 0 && t + dt >= l->fire_at) {
+      double dx = sc->x - l->pan.pos;
+      double dy = sc->y - (l->tilt.pos - l->drop);
+
+      l->fire_at = 0;
+      l->shots++;
+      *miss_px = sqrt(dx * dx + dy * dy) * SIM_PX_PER_DEG;
+      return 1;
+    }
+  }
+  return 0;
+}
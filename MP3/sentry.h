@@ -0,0 +1,667 @@
+// sentry.h - shared definitions for the sentry application
+// (launcher_fire_camera.c and the modules it is built from).
+
+#ifndef SENTRY_H
+#define SENTRY_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include "pixel422.h"
+#include "integral_image.h"
+
+#define LAUNCHER_NODE           "/dev/launcher0"
+#define LAUNCHER_FIRE           0x10
+#define LAUNCHER_STOP           0x20
+#define LAUNCHER_UP             0x02
+#define LAUNCHER_DOWN           0x01
+#define LAUNCHER_LEFT           0x04
+#define LAUNCHER_RIGHT          0x08
+#define LAUNCHER_UP_LEFT        (LAUNCHER_UP | LAUNCHER_LEFT)
+#define LAUNCHER_DOWN_LEFT      (LAUNCHER_DOWN | LAUNCHER_LEFT)
+#define LAUNCHER_UP_RIGHT       (LAUNCHER_UP | LAUNCHER_RIGHT)
+#define LAUNCHER_DOWN_RIGHT     (LAUNCHER_DOWN | LAUNCHER_RIGHT)
+
+#define DISP_WIDTH                 1920 // 15% = 288
+#define DISP_HEIGHT                1080 // 15% = 162
+#define BYTES_PER_PIX              2
+#define FRAME_BASE_ADDR            0x10000000
+#define FRAME_SIZE                 (DISP_WIDTH * DISP_HEIGHT * BYTES_PER_PIX)
+#define FRAME_WORDS_PER_ROW        (DISP_WIDTH / 2)   // [Cr][Y1][Cb][Y0] words
+
+// AXI VDMA that writes the camera frames (XPAR_AXI_VDMA_0_BASEADDR in the
+// hardware design) and the registers frame_sync.c uses
+#define VDMA_BASE_ADDR             0x43000000
+#define VDMA_MAP_SIZE              0x1000
+#define VDMA_MAX_STORES            3
+#define VDMA_PARKPTR               0x28
+#define VDMA_S2MM_DMACR            0x30
+#define VDMA_S2MM_DMASR            0x34
+#define VDMA_FRMSTORE              0x48
+#define VDMA_S2MM_START_ADDR(i)    (0xAC + 4 * (i))
+#define VDMA_DMACR_CIRCULAR        0x00000002
+#define VDMA_DMACR_FRMCNT_MASK     0x00FF0000
+#define VDMA_DMACR_FRMCNT_SHIFT    16
+#define VDMA_DMASR_FRMCNT_IRQ      0x00001000 // Write 1 to clear
+#define VDMA_PARKPTR_WRTREF_MASK   0x00001F00
+#define VDMA_PARKPTR_WRTREF_SHIFT  8
+#define VDMA_PARKPTR_WRSTORE_MASK  0x1F000000 // Store S2MM is writing now
+#define VDMA_PARKPTR_WRSTORE_SHIFT 24
+
+#define FRAME_SYNC_SPARE_STORE     2    // S2MM store to flip to when parked
+#define FRAME_SYNC_TIMEOUT_MS      100
+#define FRAME_SYNC_POLL_US         250
+
+// Target color box, in RGB
+// Center Green  R - 41, G - 92, B - 39
+// Boundary Green (Light) R - 25, G - 200, B - 17
+// Boundary Green (Dark) R - 43, G - 66, B - 50
+#define TARGET_R_MIN               25   // Exclusive bounds
+#define TARGET_R_MAX               43
+#define TARGET_G_MIN               66
+#define TARGET_G_MAX               200
+#define TARGET_B_MIN               17
+#define TARGET_B_MAX               50
+
+// Classification table: 32x32x32 bitset over (Y, Cb, Cr) >> 3. Word
+// (Cb >> 3) << 5 | (Cr >> 3) holds one bit per Y bucket, so both pixels of a
+// 4:2:2 word are tested against the same table word.
+#define TARGET_LUT_WORDS           (32 * 32)
+#define TARGET_LUT_MIN_HITS        64   // Of the 512 colors in a cell, to set its bit
+
+// The RGB box written as integer inequalities on Y, Cb and Cr. Each bound
+// is scaled so the test is exact against YCbCr_to_RGB() (which truncates),
+// e.g. 25 < R < 43 becomes 26000 <= 1000Y + 1402(Cr-128) < 43000.
+#define TARGET_YCC_R_LO            ((TARGET_R_MIN + 1) * 1000)
+#define TARGET_YCC_R_HI            (TARGET_R_MAX * 1000)
+#define TARGET_YCC_B_LO            ((TARGET_B_MIN + 1) * 1000)
+#define TARGET_YCC_B_HI            (TARGET_B_MAX * 1000)
+#define TARGET_YCC_G_LO            ((TARGET_G_MIN + 1) * 1000000)
+#define TARGET_YCC_G_HI            (TARGET_G_MAX * 1000000)
+
+// Calibrated classifier file written by target_calibrate: this header, then
+// the TARGET_LUT_WORDS table words. The ellipsoid the table was cut from is
+// kept for reference; the sentry only loads the table.
+#define TARGET_CAL_MAGIC           0x4C414354   // "TCAL"
+#define TARGET_CAL_THRESHOLD       11.34        // Chi-square, 3 dof, 99%
+#define TARGET_CAL_MIN_HITS        16           // Of the 512 colors in a cell
+#define TARGET_CAL_MAX_SAMPLES     (1 << 20)
+#define TARGET_CAL_MAX_CLUSTERS    8
+
+typedef struct {
+  uint32_t magic;
+  uint32_t words;               // TARGET_LUT_WORDS
+  uint32_t samples;             // Pixels the ellipsoid was fitted to
+  uint32_t cells;               // Bits set in the table
+  float mean[3];                // Y, Cb, Cr
+  float inv_cov[9];             // Row major
+  float threshold;              // Squared Mahalanobis distance accepted
+} target_cal_t;
+
+typedef enum {
+  CLASSIFY_RGB,                 // Reference rule, YCbCr_to_RGB() per pixel
+  CLASSIFY_LUT,                 // Quantized table lookup
+  CLASSIFY_YCC                  // Exact integer inequalities, SIMD where available
+} classify_mode_t;
+
+typedef struct classifier {
+  classify_mode_t mode;
+  uint32_t lut[TARGET_LUT_WORDS];
+  // Writes one byte per pixel (1 = target color) for nwords 4:2:2 words
+  void (*classify_row)(const struct classifier *c, const uint32_t *src, int nwords, uint8_t *mask);
+} classifier_t;
+
+// Coarse-to-fine scan. Samples are SCAN_STRIDE pixels apart in both
+// directions, so targets smaller than that can be missed.
+#define SCAN_STRIDE                8
+#define SCAN_STRIDE_WORDS          (SCAN_STRIDE / 2)
+#define SCAN_TILE                  32   // Refinement tile, in pixels
+#define SCAN_TILES_X               (DISP_WIDTH / SCAN_TILE)
+#define SCAN_TILES_Y               ((DISP_HEIGHT + SCAN_TILE - 1) / SCAN_TILE)
+
+// The coarse samples form a SCAN_GRID_COLS x SCAN_GRID_ROWS grid. A tile is
+// refined when the tiles around it hold at least the scan's density of hits
+// (1 by default: any hit at all).
+#define SCAN_GRID_COLS             (DISP_WIDTH / SCAN_STRIDE)
+#define SCAN_GRID_ROWS             (DISP_HEIGHT / SCAN_STRIDE)
+#define SCAN_TILE_SAMPLES          (SCAN_TILE / SCAN_STRIDE)
+#define SCAN_MIN_DENSITY           1
+
+typedef enum {
+  SCAN_FULL,                    // Classify every pixel
+  SCAN_COARSE                   // Sparse grid, then full resolution near hits
+} scan_mode_t;
+
+#define SCAN_MAX_THREADS           8
+#define SCAN_BENCH_FRAMES          200
+
+typedef struct {
+  int x0, y0;                   // Inclusive, x0 even
+  int x1, y1;                   // Exclusive, x1 even
+} scan_window_t;
+
+// Frame acquisition
+typedef enum {
+  FRAME_DIRECT,                 // Scan the uncached /dev/mem mapping
+  FRAME_SNAPSHOT                // Burst-copy into a cached buffer first
+} frame_mode_t;
+
+typedef struct {
+  frame_mode_t mode;
+  const volatile uint32_t *map; // The frame buffer mapping
+  uint32_t *buf;                // Snapshot, 64-byte aligned
+} frame_source_t;
+
+typedef struct {
+  int mem_fd;
+  volatile uint32_t *regs;      // VDMA registers
+  int nstores;
+  const volatile uint32_t *store[VDMA_MAX_STORES];
+  uint32_t store_addr[VDMA_MAX_STORES];
+  int circular;                 // S2MM in circular mode, else parked
+  int home, spare;              // Parked: the stores writes alternate between
+  int writing;                  // Parked: store S2MM is pointed at
+  int last;                     // Store handed out last
+  uint32_t dmacr, parkptr;      // As found, restored on close
+  int frames, skipped, timeouts;
+  double wait_ms;
+} frame_sync_t;
+
+// Connected components of the target mask
+#define BLOB_MAX_LABELS            4096 // Live at once; pixels past this are dropped
+#define BLOB_MAX                   8    // Largest blobs kept per frame
+#define BLOB_MIN_AREA              16   // Smaller blobs are noise, never aimed at
+
+typedef struct {
+  int area;
+  int x_min, x_max;             // Bounding box, inclusive
+  int y_min, y_max;
+  int64_t x_sum;                // Sums of pixel coordinates
+  int64_t y_sum;
+  int64_t xx_sum, yy_sum, xy_sum; // And of their products, for the shape
+} blob_t;
+
+// Shape of a blob from its moments
+typedef struct {
+  double cx, cy;                // Centroid
+  double orientation;           // Of the major axis, radians from +x (y down)
+  double major, minor;          // Standard deviations along the axes
+  double eccentricity;          // 0 for a disc or square, towards 1 for a line
+  double fill;                  // Area over bounding box area
+} blob_shape_t;
+
+// Blobs failing these never reach the tracker. A limit of 0 is no limit.
+#define SHAPE_MIN_FILL             0.4
+#define SHAPE_MAX_ECCENTRICITY     0.95 // About 3:1 for a filled rectangle
+
+typedef struct {
+  int min_area, max_area;
+  double min_fill;
+  double max_eccentricity;
+} shape_gate_t;
+
+typedef struct {
+  int16_t start, end;           // Inclusive columns
+  int label;                    // -1 when labels ran out
+} blob_run_t;
+
+typedef struct {
+  int row;                      // Row the current runs belong to
+  blob_run_t runs[2][DISP_WIDTH / 2 + 1];
+  blob_run_t *prev, *cur;
+  int nprev, ncur;
+  int next;                     // First run above that can touch the next run
+  int nlabels;                  // Labels ever handed out this frame
+  int nfree;
+  int free[BLOB_MAX_LABELS];    // Recycled labels
+  uint32_t epoch;               // Row switches, for stamp
+  uint32_t stamp[BLOB_MAX_LABELS];
+  int parent[BLOB_MAX_LABELS];
+  blob_t stats[BLOB_MAX_LABELS]; // Valid at roots
+  int ntop;
+  blob_t top[BLOB_MAX];         // Largest finished blobs, largest first
+  int components;               // Finished blobs
+  int rejected;                 // Of those, failed the shape gate
+  int overflow;                 // Pixels dropped for lack of labels
+  shape_gate_t gate;
+} labeler_t;
+
+typedef struct {
+  int count;                    // Target pixels found
+  int64_t x_sum;                // Sums of their coordinates
+  int64_t y_sum;
+  int tiles;                    // Tiles classified at full resolution
+  int components;               // Blobs found
+  int rejected;                 // Blobs that failed the shape gate
+  scan_window_t dense;          // Coarse scan: the 3x3 tiles with the most hits
+  int dense_hits;
+  int nblobs;
+  blob_t blobs[BLOB_MAX];       // Largest first
+} scan_result_t;
+
+// Motion detector: a running background of the Y plane, sampled every
+// MOTION_STEP pixels in both directions, and the cells that differ from it
+#define MOTION_STEP                4
+#define MOTION_COLS                (DISP_WIDTH / MOTION_STEP)
+#define MOTION_ROWS                (DISP_HEIGHT / MOTION_STEP)
+#define MOTION_THRESHOLD           24   // Y difference that counts as foreground
+#define MOTION_WARMUP              8    // Frames after a reset before anything is reported
+#define MOTION_BG_FRAC             4    // Fraction bits of the background
+#define MOTION_VERIFY_FRAMES       64   // Enough for any start to settle on any level
+
+typedef enum {
+  DETECT_COLOR,                 // Target color classifier
+  DETECT_MOTION,                // Anything that moves against the background
+  DETECT_TEMPLATE,              // A stored pattern, by NCC of the Y plane
+  DETECT_CIRCLE                 // Round targets, by a Hough transform of the Y edges
+} detect_mode_t;
+
+typedef struct {
+  int frames;                   // Since the background was reset
+  uint16_t bg[MOTION_ROWS][MOTION_COLS];  // Y << MOTION_BG_FRAC
+  labeler_t labeler;
+} motion_t;
+
+// Template matcher: Y plane pyramid at 1/2 to 1/(2^TEMPLATE_LEVELS)
+// resolution, whole-frame NCC at the coarsest level the template allows,
+// refinement around the best candidates at the finer ones
+#define TEMPLATE_LEVELS            4
+#define TEMPLATE_MAX_SIZE          256  // Template width and height, pixels
+#define TEMPLATE_MIN_COARSE        8    // Template side at the coarsest level searched
+#define TEMPLATE_CANDIDATES        4    // Peaks followed down from the coarse search
+#define TEMPLATE_REFINE            2    // Search radius at each finer level, in its pixels
+#define TEMPLATE_MIN_COARSE_SCORE  0.5  // NCC at the coarsest level to be a candidate
+#define TEMPLATE_MIN_SCORE         0.7  // NCC at level 1 to report a match
+
+typedef struct {
+  int width, height;
+  int stride;                   // Row length of t and mask, whole vectors
+  int n;                        // Pixels
+  int16_t *t;                   // Template minus its mean, zero padded
+  int tsum;                     // Sum of t, not quite 0 after rounding
+  int16_t *mask;                // -1 over the template, 0 in the padding
+  double norm;                  // sqrt(sum of t^2)
+} template_level_t;
+
+typedef struct {
+  int width, height;            // Template, full resolution
+  int coarse;                   // Level the whole frame is searched at
+  template_level_t level[TEMPLATE_LEVELS + 1]; // From 1; level 0 unused
+  uint8_t *pyr[TEMPLATE_LEVELS + 1];           // Frame pyramid, from 1
+  float *score_map;             // NCC at every coarse position
+  double score;                 // Best in the last frame
+} matcher_t;
+
+// Circle detector: Sobel edges of the Y plane at 1/(2^HOUGH_LEVEL)
+// resolution, each voting for the centres along its gradient. Radii are
+// found afterwards, per centre, so the accumulator has no radius axis.
+#define HOUGH_LEVEL                2
+#define HOUGH_WIDTH                (DISP_WIDTH >> HOUGH_LEVEL)
+#define HOUGH_HEIGHT               (DISP_HEIGHT >> HOUGH_LEVEL)
+#define HOUGH_EDGE                 96   // |Gx| + |Gy| of an edge pixel
+#define HOUGH_MAX_EDGES            16384 // Edge pixels voting per frame; the rest are dropped
+#define HOUGH_MIN_RADIUS           16   // Default radius range, full resolution pixels
+#define HOUGH_MAX_RADIUS           128
+#define HOUGH_MIN_VOTES            8    // In the 3x3 cells around a centre
+#define HOUGH_NMS                  2    // A centre is the largest within +-this many cells
+#define HOUGH_MIN_SUPPORT          0.7  // Fraction of a circle's edge that must be found
+#define HOUGH_ALIGN                0.95 // cos of the largest gradient to radius angle
+
+typedef struct {
+  double x, y;                  // Centre, full resolution
+  double r;                     // Radius, full resolution
+  int votes;                    // Centre votes
+  double support;               // Fraction of the edge found
+} circle_t;
+
+typedef struct {
+  int16_t x, y;
+  int16_t gx, gy;
+} hough_edge_t;
+
+typedef struct {
+  int min_r, max_r;             // Radius range, level pixels
+  uint8_t plane[HOUGH_HEIGHT][HOUGH_WIDTH];
+  uint16_t acc[HOUGH_HEIGHT][HOUGH_WIDTH];
+  int nedges;                   // Voted in the last frame
+  int dropped;                  // Edge pixels past HOUGH_MAX_EDGES
+  hough_edge_t edges[HOUGH_MAX_EDGES];
+  int ncircles;
+  circle_t circles[BLOB_MAX];   // Most votes first
+} hough_t;
+
+// CamShift follower for a locked target. The model is P(target | Cb, Cr),
+// scaled to 0..255, over the LUT's 32x32 chroma cells, from the lock-on box
+// against a ring of background around it.
+#define CAMSHIFT_BINS              (32 * 32)
+#define CAMSHIFT_RING              16   // Width of the background ring, pixels
+#define CAMSHIFT_MIN_Y             32   // Darker pixels have no usable chroma
+#define CAMSHIFT_MIN_P             128  // Cells less likely target than not weigh 0
+#define CAMSHIFT_MAX_ITER          10
+#define CAMSHIFT_EPSILON           1.0  // Converged once the window moves less, pixels
+#define CAMSHIFT_GROW              1.5  // Window over the target's 2-sigma extent
+#define CAMSHIFT_MIN_HALF          8    // Smallest window half-size, pixels
+#define CAMSHIFT_MIN_MASS          0.25 // Lost below this fraction of the first mass
+
+typedef struct {
+  int active;
+  uint8_t model[CAMSHIFT_BINS];
+  double mass0;                 // Target pixels in the first frame tracked
+  double cx, cy;                // Converged window center
+  double half_w, half_h;        // Window half-size for the next frame
+  double orientation;           // Of the target's major axis, radians
+  int iterations;               // Mean-shift steps in the last frame
+} camshift_t;
+
+// Tracker. Variances are in pixels^2 (and pixels/s for velocity).
+#define TRACK_MAX                  8
+#define TRACK_CONFIRM              3    // Hits before a track can be aimed at
+#define TRACK_MAX_MISSES           5    // Frames a confirmed track survives unseen
+#define TRACK_GATE                 13.8 // Chi-square, 2 dof, 99.9%
+#define TRACK_MEAS_VAR             16.0 // Centroid noise
+#define TRACK_ACCEL_VAR            4.0e5
+#define TRACK_INIT_VEL_VAR         1.0e5
+#define TRACK_LEAD_S               0.1  // Aim this far ahead of the last frame
+
+// Lock-on window around the predicted target position: the blob's half
+// size plus TRACK_WIN_SIGMA standard deviations of the predicted position
+// and a margin, doubled for every frame the target has been missed. Past
+// TRACK_WIN_MAX_AREA of the frame the full acquisition scan is used.
+#define TRACK_WIN_SIGMA            4.0
+#define TRACK_WIN_MARGIN           24
+#define TRACK_WIN_MAX_AREA         0.5
+
+typedef struct {
+  double pos, vel;
+  double p00, p01, p11;         // Covariance
+} kalman_axis_t;
+
+typedef struct {
+  int id;
+  kalman_axis_t x, y;
+  int area;                     // Of the last detection
+  int width, height;            // Bounding box of the last detection
+  int hits;
+  int misses;                   // Consecutive frames without a detection
+} track_t;
+
+typedef struct {
+  int ntracks;
+  track_t tracks[TRACK_MAX];
+  int next_id;
+  int target_id;                // 0 when nothing is being aimed at
+} tracker_t;
+
+
+// Actuator thread and the mailbox of aim commands that feeds it
+#define AIM_SLOT_FRESH             4    // Published slot not taken yet
+#define ACT_POLL_MS                2
+#define ACT_MAX_AGE_MS             200  // Older commands are dropped unexecuted
+#define ACT_FIRE_RAISE_MS          125
+#define ACT_FIRE_SETTLE_MS         500
+#define ACT_FIRE_RELOAD_MS         5500
+#define REPLAY_FRAME_MS            (1000.0 / 60)
+
+typedef enum {
+  AIM_STOP,
+  AIM_MOVE,                     // Run each axis for its own time
+  AIM_FIRE                      // Raise, settle and fire
+} aim_type_t;
+
+typedef struct {
+  aim_type_t type;
+  int direction;                // LAUNCHER_LEFT/RIGHT, ORed with UP/DOWN
+  int pan_ms, tilt_ms;          // Motor time for each axis in direction
+  double issued_ms;
+  unsigned seq;                 // Submission number, for the trace
+} aim_cmd_t;
+
+// Three slots: the producer's, the consumer's and the published one.
+// Publishing swaps the producer's slot for the published one, taking swaps
+// the consumer's, so neither side waits and a newer command always replaces
+// an older one not yet taken.
+typedef struct {
+  aim_cmd_t slots[3];
+  atomic_uint latest;           // Published slot, | AIM_SLOT_FRESH until taken
+  unsigned back;                // Producer only
+  unsigned front;               // Consumer only
+} aim_mailbox_t;
+
+typedef struct {
+  int fd;                       // LAUNCHER_NODE
+  pthread_t thread;
+  aim_mailbox_t mailbox;
+  atomic_int quit;
+
+  // Actuator thread only
+  aim_cmd_t pending;
+  int has_pending;
+  int moving;
+  int direction;                // Axes running, as sent
+  double pan_until, tilt_until;
+  int executed, dropped, stale, fired;
+
+  // Detector thread only
+  int submitted, replaced;      // Replaced in the mailbox before being taken
+} actuator_t;
+
+// Aim controller. The motor model converts a pixel correction into motor
+// time: each axis sweeps the image at a fixed rate once it has spun up.
+// The rates and lag are for the camera on the launcher at 1920x1080.
+#define AIM_PAN_PX_PER_MS          0.6
+#define AIM_TILT_PX_PER_MS         0.4
+#define AIM_MOTOR_LAG_MS           30   // From rest until the image moves
+#define AIM_MAX_MOVE_MS            400  // Saturation, per command
+#define AIM_FIRE_RADIUS            15   // Close enough to fire, in pixels from the center
+#define AIM_FIRE_FRAMES            2    // Still frames in a row inside it before firing
+#define AIM_DEADBAND_X             10   // An axis holds inside this, in pixels; both inside
+#define AIM_DEADBAND_Y             10   // is inside AIM_FIRE_RADIUS
+#define AIM_KP                     0.8  // Pixels corrected per pixel of error
+#define AIM_KI                     0.5  // Per pixel-second
+#define AIM_KD                     0.05 // Per pixel/s
+#define AIM_I_LIMIT                200.0 // Pixel-seconds
+
+typedef enum {
+  AIM_LAW_STEP,                 // One axis per frame, time proportional to error
+  AIM_LAW_PID                   // Both axes, PID through the motor model
+} aim_law_t;
+
+typedef struct {
+  double integral;              // Pixel-seconds
+  double last_error;
+  int has_last;
+  int sign;                     // Direction the axis was last run in
+  double since;                 // When that run started from rest
+  double run_until;             // When that run ends
+} aim_axis_t;
+
+typedef struct {
+  aim_law_t law;
+  aim_axis_t pan, tilt;
+  double last_ms;
+  int centered;                 // Still frames in a row with the target in the fire gate
+} aim_ctrl_t;
+
+// Closed-loop benchmark: a rendered scene with a moving target, seen by a
+// camera on a virtual launcher. The launcher's motors run at SIM_RATE_ERROR
+// of the aim controller's model, spin up and coast, stop at the end of
+// their travel and release the dart SIM_FIRE_DELAY_MS after FIRE. The dart
+// drops by as much as the launcher's own tilt motor raises it over
+// ACT_FIRE_RAISE_MS, so a launcher that was on target when the fire
+// sequence began shoots straight.
+#define SIM_MAX_FRAMES             600
+#define SIM_RATE_ERROR             0.85
+#define SIM_TARGET_RADIUS          30
+#define SIM_PX_PER_DEG             32.0 // Camera: 1920 pixels over 60 degrees
+#define SIM_PAN_MIN_DEG            -135.0
+#define SIM_PAN_MAX_DEG            135.0
+#define SIM_TILT_MIN_DEG           -5.0
+#define SIM_TILT_MAX_DEG           30.0
+#define SIM_SPINUP_MS              (2 * AIM_MOTOR_LAG_MS) // Rest to full speed, loses AIM_MOTOR_LAG_MS
+#define SIM_COAST_MS               20   // Full speed to rest
+#define SIM_FIRE_DELAY_MS          1000 // FIRE to the dart leaving
+#define SIM_TARGET_SPEED           0.5  // Largest target speed, degrees/s
+#define SIM_TARGET_RANGE           20.0 // Target stays within this of the start, degrees
+#define SIM_TILE                   64   // Background pattern period, pixels
+#define SIM_STEP_MS                1.0  // Launcher simulation step
+#define SIM_LOG_LEN                4096 // Commands a replay records
+
+typedef struct {
+  double pos;                   // Degrees; pan right or tilt up positive
+  double vel;                   // Degrees/ms
+  int drive;                    // -1, 0 or 1
+  double rate;                  // Full speed, degrees/ms
+  double min, max;
+} sim_axis_t;
+
+typedef struct {
+  int frame;                    // Being processed when the command came
+  double ms;
+  int cmd;
+} sim_log_t;
+
+// The launcher as the USB commands drive it
+typedef struct {
+  sim_axis_t pan, tilt;
+  double fire_at;               // Dart leaves at this time, 0 if not firing
+  double drop;                  // Of the dart, degrees
+  int shots;
+  int frame;                    // Set by the caller, for the log
+  sim_log_t *log;               // SIM_LOG_LEN commands received, or NULL
+  int nlog;
+} sim_launcher_t;
+
+// The actuator's handling of aim commands, on simulated time
+typedef struct {
+  int direction;                // Axes running, LAUNCHER_* bits
+  double pan_until, tilt_until;
+  double fire_start;            // Fire sequence began
+  int fire_step;                // Commands of the sequence sent so far, 0 if none
+} sim_actuator_t;
+
+typedef struct {
+  uint32_t target_word;
+  uint32_t *tile;               // SIM_TILE rows of DISP_WIDTH + SIM_TILE pixels
+  double x, y;                  // Target bearing and elevation, degrees
+  double vx, vy;                // Degrees/ms
+  double x0, y0;                // Where it started
+} scene_t;
+
+
+// Function prototypes (scene_sim.c)
+uint32_t sim_target_word(const classifier_t *c);
+int scene_init(scene_t *sc, uint32_t target_word);
+void scene_free(scene_t *sc);
+void scene_place(scene_t *sc, const sim_launcher_t *l);
+void scene_render(const scene_t *sc, const sim_launcher_t *l, uint32_t *frame);
+void sim_launcher_init(sim_launcher_t *l);
+void sim_launcher_cmd(sim_launcher_t *l, int cmd, double t);
+void sim_actuator_init(sim_actuator_t *a);
+void sim_actuator_submit(sim_actuator_t *a, sim_launcher_t *l, const aim_cmd_t *c, double t);
+void sim_actuator_timers(sim_actuator_t *a, sim_launcher_t *l, double t);
+int sim_on_target(const scene_t *sc, const sim_launcher_t *l);
+int sim_advance(scene_t *sc, sim_actuator_t *a, sim_launcher_t *l, double t0, double t1, double *miss_px);
+
+// Function prototypes (target_classify.c)
+void YCbCr_to_RGB(int YCbCr[3], int RGB[3]);
+int target_rgb_match(int Y, int Cb, int Cr);
+int target_ycc_match(int Y, int Cb, int Cr);
+int classifier_init(classifier_t *c, classify_mode_t mode);
+const char *classifier_name(classify_mode_t mode);
+long classifier_verify(void);
+int classifier_load(classifier_t *c, const char *path, target_cal_t *cal);
+int classifier_save(const char *path, const target_cal_t *cal, const uint32_t *lut);
+
+// Function prototypes (blob_label.c)
+void blob_begin(labeler_t *l);
+void blob_add_run(labeler_t *l, int row, int start, int end);
+int blob_end(labeler_t *l, blob_t *blobs, int max);
+void blob_set_gate(labeler_t *l, const shape_gate_t *gate);
+void blob_shape(const blob_t *b, blob_shape_t *s);
+int blob_shape_ok(const blob_t *b, const shape_gate_t *gate);
+
+// Function prototypes (template_match.c)
+int template_load(matcher_t *m, const char *path, const scan_window_t *rect);
+void template_scan(matcher_t *m, const uint32_t *frame, scan_result_t *r);
+void template_reduce_frame_row(const uint32_t *a, const uint32_t *b, uint8_t *out);
+void template_reduce_row(const uint8_t *a, const uint8_t *b, uint8_t *out, int n);
+
+// Function prototypes (hough_circle.c)
+int hough_init(hough_t *h, int min_r, int max_r);
+void hough_scan(hough_t *h, const uint32_t *frame, scan_result_t *r);
+long hough_verify(void);
+
+// Function prototypes (camshift.c)
+int camshift_lock(camshift_t *cs, const uint32_t *frame, const scan_window_t *box);
+int camshift_track(camshift_t *cs, const uint32_t *frame, const scan_window_t *limit, double x, double y,
+                   blob_t *b);
+long camshift_verify(void);
+
+// Function prototypes (tracker.c)
+void tracker_init(tracker_t *tr);
+void tracker_update(tracker_t *tr, const blob_t *blobs, int nblobs, double dt);
+void tracker_shift(tracker_t *tr, double dx, double dy);
+const track_t *tracker_target(tracker_t *tr);
+void track_predict(const track_t *t, double ahead, double *x, double *y);
+int track_window(const track_t *t, double ahead, scan_window_t *w);
+
+// Function prototypes (frame_acquire.c)
+int frame_source_init(frame_source_t *fs, frame_mode_t mode, const volatile uint32_t *map);
+const char *frame_mode_name(frame_mode_t mode);
+const uint32_t *frame_acquire(frame_source_t *fs, const scan_window_t *w);
+void frame_benchmark(frame_source_t *fs);
+
+// Function prototypes (actuator.c)
+void launcher_cmd(int fd, int cmd);
+const char *launcher_cmd_name(int cmd);
+const char *aim_type_name(aim_type_t type);
+int actuator_start(actuator_t *a, int fd);
+void actuator_submit(actuator_t *a, const aim_cmd_t *c);
+void actuator_stop(actuator_t *a);
+
+// Function prototypes (aim_control.c)
+void aim_init(aim_ctrl_t *a, aim_law_t law);
+void aim_reset(aim_ctrl_t *a);
+aim_cmd_t aim_update(aim_ctrl_t *a, double now_x, double now_y, double err_x, double err_y, double clock_ms);
+void aim_motion(const aim_ctrl_t *a, double from_ms, double to_ms, double *dx, double *dy);
+int aim_in_gate(double x, double y);
+const char *aim_law_name(aim_law_t law);
+
+// Function prototypes (frame_sync.c)
+int frame_sync_open(frame_sync_t *fs, int mem_fd);
+const volatile uint32_t *frame_sync_wait(frame_sync_t *fs);
+void frame_sync_close(frame_sync_t *fs);
+
+// Function prototypes (motion_detect.c)
+void motion_reset(motion_t *m);
+void motion_scan(motion_t *m, const uint32_t *frame, scan_result_t *r);
+long motion_verify(void);
+const char *detect_mode_name(detect_mode_t mode);
+
+// Function prototypes (integral_image.c)
+long integral_verify(void);
+
+// Function prototypes (frame_scan.c)
+void scan_full(const classifier_t *c, const uint32_t *frame, scan_result_t *r);
+void scan_coarse(const classifier_t *c, const uint32_t *frame, scan_result_t *r);
+void scan_window(const classifier_t *c, const uint32_t *frame, const scan_window_t *w, scan_result_t *r);
+void scan_set_gate(const shape_gate_t *gate);
+void scan_set_density(int min_hits);
+int scan_threads_start(int nthreads);
+void scan_threads_stop(void);
+double scan_banded_time(void);
+
+// Event trace, written as Chrome trace JSON
+#define TRACE_MAX_THREADS          16
+#define TRACE_EVENTS               65536 // Per thread; later ones are dropped
+
+// Function prototypes (trace.c)
+int trace_open(const char *path);
+int trace_close(void);
+void trace_thread_name(const char *name);
+int64_t trace_now(void);
+void trace_span(const char *name, int64_t start, const char *arg_name, int arg);
+void trace_mark(const char *name, const char *arg_name, int arg);
+void trace_flow(const char *name, int start, unsigned id);
+
+#endif // SENTRY_H
@@ -0,0 +1,419 @@
+// Target color calibration. Reads sample frames (raw 4:2:2, back to back, as
+// saved for replay) and a rectangle marked around the target, clusters the
+// rectangle's pixels in (Y, Cb, Cr) with k-means, fits a Gaussian to the
+// cluster that fills the middle of the rectangle and writes the ellipsoid it
+// bounds as a classifier table for the sentry (launcher_fire_camera -l).
+//
+//   target_calibrate -r x0,y0,x1,y1 [-k clusters] [-t threshold] [-m hits] [-o target.cal] frames.yuv...
+//     -r  target rectangle in pixels, x1 and y1 exclusive
+//     -k  clusters (default 3; 1 fits a single Gaussian to the whole rectangle)
+//     -t  squared Mahalanobis distance accepted (default 11.34, 99%)
+//     -m  colors of a table cell that must fall in the ellipsoid (default 16 of 512)
+//     -o  output file (default target.cal)
+//
+// Pixels outside the rectangle are counted as background, and the table's
+// hit rate on them is printed so the threshold can be traded against false
+// alarms before the file is used.
+//
+// Build: gcc -O2 -I../common -o target_calibrate target_calibrate.c target_classify.c -lm
+
+#include <fcntl.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "sentry.h"
+
+#define CAL_KMEANS_ITERATIONS      30
+#define CAL_COV_FLOOR              1.0  // Added to the variances, quantization noise
+
+typedef struct {
+  uint8_t ycc[3];               // Y, Cb, Cr
+  uint8_t inner;                // In the middle half of the rectangle
+} cal_sample_t;
+
+static uint32_t frame[FRAME_SIZE / 4];
+static cal_sample_t samples[TARGET_CAL_MAX_SAMPLES];
+static int cluster_of[TARGET_CAL_MAX_SAMPLES];
+static uint32_t background[32 * 32 * 32];     // Outside the rectangle, per table cell
+
+
+static int cell_index(int Y, int Cb, int Cr) {
+  return ((Cb >> 3) << 10) | ((Cr >> 3) << 5) | (Y >> 3);
+}
+
+static double sq_dist(const double a[3], const uint8_t b[3]) {
+  double d0 = a[0] - b[0], d1 = a[1] - b[1], d2 = a[2] - b[2];
+  return d0 * d0 + d1 * d1 + d2 * d2;
+}
+
+static double mahalanobis(const target_cal_t *cal, double Y, double Cb, double Cr) {
+  double d[3] = {Y - cal->mean[0], Cb - cal->mean[1], Cr - cal->mean[2]};
+  double sum = 0;
+  int i, j;
+
+  for (i = 0; i < 3; i++) {
+    for (j = 0; j < 3; j++) {
+      sum += d[i] * cal->inv_cov[3 * i + j] * d[j];
+    }
+  }
+  return sum;
+}
+
+// Read every frame of a file, keeping every stride-th pixel of the rectangle
+// and binning the rest of the frame into the background histogram
+static int read_samples(const char *path, const scan_window_t *r, int stride, int *nsamples,
+                        long *visited, long *nbackground) {
+  pix422_view_t view = pix422_view(frame, DISP_WIDTH, DISP_HEIGHT, FRAME_WORDS_PER_ROW);
+  pix422_iter_t it;
+  pix422_pair_t p;
+  struct stat st;
+  int fd, i, row, col, nframes;
+  int ix0 = r->x0 + (r->x1 - r->x0) / 4, ix1 = r->x1 - (r->x1 - r->x0) / 4;
+  int iy0 = r->y0 + (r->y1 - r->y0) / 4, iy1 = r->y1 - (r->y1 - r->y0) / 4;
+
+  if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+    perror(path);
+    return -1;
+  }
+  nframes = st.st_size / FRAME_SIZE;
+
+  for (i = 0; i < nframes; i++) {
+    if (pread(fd, frame, FRAME_SIZE, (off_t)i * FRAME_SIZE) != FRAME_SIZE) {
+      perror(path);
+      close(fd);
+      return -1;
+    }
+
+    it = pix422_begin(&view);
+    while (pix422_next(&it, &p)) {
+      row = it.y;
+      for (col = it.x; col < it.x + 2; col++) {
+        int Y = (col & 1) ? p.y1 : p.y0;
+        int Cb = p.cb, Cr = p.cr;
+
+        if (row < r->y0 || row >= r->y1 || col < r->x0 || col >= r->x1) {
+          background[cell_index(Y, Cb, Cr)]++;
+          (*nbackground)++;
+        } else if ((*visited)++ % stride == 0 && *nsamples < TARGET_CAL_MAX_SAMPLES) {
+          cal_sample_t *s = &samples[(*nsamples)++];
+
+          s->ycc[0] = Y;
+          s->ycc[1] = Cb;
+          s->ycc[2] = Cr;
+          s->inner = row >= iy0 && row < iy1 && col >= ix0 && col < ix1;
+        }
+      }
+    }
+  }
+
+  printf("%s: %d frames\n", path, nframes);
+  close(fd);
+  return nframes;
+}
+
+// Lloyd's k-means. The first center is the mean of the middle of the
+// rectangle, each further one the sample farthest from the centers so far.
+// Returns the cluster holding most of the middle samples.
+static int kmeans(int n, int k, double centers[][3], int *counts) {
+  double sums[TARGET_CAL_MAX_CLUSTERS][3];
+  int inner[TARGET_CAL_MAX_CLUSTERS];
+  int i, j, c, iter, changed, ninner = 0, best;
+
+  memset(centers[0], 0, 3 * sizeof(double));
+  for (i = 0; i < n; i++) {
+    if (samples[i].inner) {
+      for (j = 0; j < 3; j++) {
+        centers[0][j] += samples[i].ycc[j];
+      }
+      ninner++;
+    }
+  }
+  for (j = 0; j < 3; j++) {
+    centers[0][j] /= (ninner > 0) ? ninner : 1;
+  }
+
+  for (c = 1; c < k; c++) {
+    double far = -1;
+    int pick = 0;
+
+    for (i = 0; i < n; i++) {
+      double d = DBL_MAX;
+
+      for (j = 0; j < c; j++) {
+        double dj = sq_dist(centers[j], samples[i].ycc);
+        if (dj < d) {
+          d = dj;
+        }
+      }
+      if (d > far) {
+        far = d;
+        pick = i;
+      }
+    }
+    for (j = 0; j < 3; j++) {
+      centers[c][j] = samples[pick].ycc[j];
+    }
+  }
+
+  for (i = 0; i < n; i++) {
+    cluster_of[i] = -1;
+  }
+  for (iter = 0; iter < CAL_KMEANS_ITERATIONS; iter++) {
+    changed = 0;
+    memset(sums, 0, sizeof(sums));
+    memset(counts, 0, k * sizeof(int));
+    memset(inner, 0, sizeof(inner));
+
+    for (i = 0; i < n; i++) {
+      double d = DBL_MAX;
+
+      best = 0;
+      for (c = 0; c < k; c++) {
+        double dc = sq_dist(centers[c], samples[i].ycc);
+        if (dc < d) {
+          d = dc;
+          best = c;
+        }
+      }
+      changed += (cluster_of[i] != best);
+      cluster_of[i] = best;
+      counts[best]++;
+      inner[best] += samples[i].inner;
+      for (j = 0; j < 3; j++) {
+        sums[best][j] += samples[i].ycc[j];
+      }
+    }
+
+    for (c = 0; c < k; c++) {
+      if (counts[c] > 0) {
+        for (j = 0; j < 3; j++) {
+          centers[c][j] = sums[c][j] / counts[c];
+        }
+      }
+    }
+    if (changed == 0) {
+      break;
+    }
+  }
+
+  best = 0;
+  for (c = 1; c < k; c++) {
+    if (inner[c] > inner[best]) {
+      best = c;
+    }
+  }
+  return best;
+}
+
+// Mean and inverse covariance of one cluster
+static int fit_gaussian(int n, int cluster, target_cal_t *cal) {
+  double mean[3] = {0, 0, 0}, cov[3][3], inv[3][3], det;
+  int i, j, l, count = 0;
+
+  for (i = 0; i < n; i++) {
+    if (cluster_of[i] == cluster) {
+      for (j = 0; j < 3; j++) {
+        mean[j] += samples[i].ycc[j];
+      }
+      count++;
+    }
+  }
+  if (count == 0) {
+    return -1;
+  }
+  for (j = 0; j < 3; j++) {
+    mean[j] /= count;
+  }
+
+  memset(cov, 0, sizeof(cov));
+  for (i = 0; i < n; i++) {
+    if (cluster_of[i] == cluster) {
+      for (j = 0; j < 3; j++) {
+        for (l = 0; l < 3; l++) {
+          cov[j][l] += (samples[i].ycc[j] - mean[j]) * (samples[i].ycc[l] - mean[l]);
+        }
+      }
+    }
+  }
+  for (j = 0; j < 3; j++) {
+    for (l = 0; l < 3; l++) {
+      cov[j][l] /= count;
+    }
+    cov[j][j] += CAL_COV_FLOOR;
+  }
+
+  // Adjugate over determinant
+  inv[0][0] = cov[1][1] * cov[2][2] - cov[1][2] * cov[2][1];
+  inv[0][1] = cov[0][2] * cov[2][1] - cov[0][1] * cov[2][2];
+  inv[0][2] = cov[0][1] * cov[1][2] - cov[0][2] * cov[1][1];
+  inv[1][0] = cov[1][2] * cov[2][0] - cov[1][0] * cov[2][2];
+  inv[1][1] = cov[0][0] * cov[2][2] - cov[0][2] * cov[2][0];
+  inv[1][2] = cov[0][2] * cov[1][0] - cov[0][0] * cov[1][2];
+  inv[2][0] = cov[1][0] * cov[2][1] - cov[1][1] * cov[2][0];
+  inv[2][1] = cov[0][1] * cov[2][0] - cov[0][0] * cov[2][1];
+  inv[2][2] = cov[0][0] * cov[1][1] - cov[0][1] * cov[1][0];
+  det = cov[0][0] * inv[0][0] + cov[0][1] * inv[1][0] + cov[0][2] * inv[2][0];
+
+  for (j = 0; j < 3; j++) {
+    cal->mean[j] = mean[j];
+    for (l = 0; l < 3; l++) {
+      cal->inv_cov[3 * j + l] = inv[j][l] / det;
+    }
+  }
+  cal->samples = count;
+
+  printf("Fit to %d pixels: mean Y %.1f Cb %.1f Cr %.1f, sd %.1f %.1f %.1f\n",
+         count, mean[0], mean[1], mean[2], sqrt(cov[0][0]), sqrt(cov[1][1]), sqrt(cov[2][2]));
+  return 0;
+}
+
+// Set each cell's bit when at least min_hits of its 8x8x8 colors fall inside
+// the ellipsoid. The cell holding the mean is always set.
+static void build_table(target_cal_t *cal, int min_hits, uint32_t *lut) {
+  int cb, cr, y, dy, dcb, dcr, hits;
+
+  memset(lut, 0, TARGET_LUT_WORDS * sizeof(uint32_t));
+  cal->cells = 0;
+  for (cb = 0; cb < 32; cb++) {
+    for (cr = 0; cr < 32; cr++) {
+      for (y = 0; y < 32; y++) {
+        hits = 0;
+        for (dcb = 0; dcb < 8; dcb++) {
+          for (dcr = 0; dcr < 8; dcr++) {
+            for (dy = 0; dy < 8; dy++) {
+              hits += mahalanobis(cal, 8 * y + dy, 8 * cb + dcb, 8 * cr + dcr) <= cal->threshold;
+            }
+          }
+        }
+        if (hits >= min_hits || cell_index(cal->mean[0], cal->mean[1], cal->mean[2]) == ((cb << 10) | (cr << 5) | y)) {
+          lut[(cb << 5) | cr] |= 1u << y;
+          cal->cells++;
+        }
+      }
+    }
+  }
+}
+
+static int table_hit(const uint32_t *lut, const uint8_t ycc[3]) {
+  int i = cell_index(ycc[0], ycc[1], ycc[2]);
+  return (lut[i >> 5] >> (i & 0x1F)) & 1;
+}
+
+int main(int argc, char *argv[]) {
+  scan_window_t rect = {0, 0, 0, 0};
+  int k = 3;
+  int min_hits = TARGET_CAL_MIN_HITS;
+  const char *out = "target.cal";
+  static target_cal_t cal = {TARGET_CAL_MAGIC, TARGET_LUT_WORDS, 0, 0, {0}, {0}, TARGET_CAL_THRESHOLD};
+  static uint32_t lut[TARGET_LUT_WORDS];
+  double centers[TARGET_CAL_MAX_CLUSTERS][3];
+  int counts[TARGET_CAL_MAX_CLUSTERS];
+  long total = 0, visited = 0, nbackground = 0, bg_hits = 0;
+  int nsamples = 0, nframes = 0, stride, target, cluster_hits, cluster_size, inner_hits, ninner;
+  int i, c, opt;
+  struct stat st;
+
+  while ((opt = getopt(argc, argv, "r:k:t:m:o:")) != -1) {
+    switch (opt) {
+      case 'r':
+        if (sscanf(optarg, "%d,%d,%d,%d", &rect.x0, &rect.y0, &rect.x1, &rect.y1) != 4) {
+          fprintf(stderr, "Rectangle must be x0,y0,x1,y1\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'k': k = atoi(optarg); break;
+      case 't': cal.threshold = atof(optarg); break;
+      case 'm': min_hits = atoi(optarg); break;
+      case 'o': out = optarg; break;
+      default:
+        fprintf(stderr, "Usage: %s -r x0,y0,x1,y1 [-k clusters] [-t threshold] [-m hits] [-o target.cal] frames.yuv...\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  if (rect.x0 < 0 || rect.y0 < 0 || rect.x1 > DISP_WIDTH || rect.y1 > DISP_HEIGHT ||
+      rect.x1 - rect.x0 < 4 || rect.y1 - rect.y0 < 4) {
+    fprintf(stderr, "Rectangle %d,%d,%d,%d is empty or outside the %dx%d frame\n",
+            rect.x0, rect.y0, rect.x1, rect.y1, DISP_WIDTH, DISP_HEIGHT);
+    exit(EXIT_FAILURE);
+  }
+  if (k < 1 || k > TARGET_CAL_MAX_CLUSTERS) {
+    fprintf(stderr, "Clusters must be 1 to %d\n", TARGET_CAL_MAX_CLUSTERS);
+    exit(EXIT_FAILURE);
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "No sample frames given\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Thin the rectangle evenly over all frames to fit the sample buffer
+  for (i = optind; i < argc; i++) {
+    if (stat(argv[i], &st) == 0) {
+      total += (long)(st.st_size / FRAME_SIZE) * (rect.x1 - rect.x0) * (rect.y1 - rect.y0);
+    }
+  }
+  stride = (total + TARGET_CAL_MAX_SAMPLES - 1) / TARGET_CAL_MAX_SAMPLES;
+  if (stride < 1) {
+    stride = 1;
+  }
+
+  for (i = optind; i < argc; i++) {
+    int n = read_samples(argv[i], &rect, stride, &nsamples, &visited, &nbackground);
+    if (n < 0) {
+      exit(EXIT_FAILURE);
+    }
+    nframes += n;
+  }
+  if (nsamples == 0) {
+    fprintf(stderr, "No full frames in the sample files\n");
+    exit(EXIT_FAILURE);
+  }
+  printf("%d samples from %d frames (every %d pixel%s of the rectangle)\n",
+         nsamples, nframes, stride, stride == 1 ? "" : "s");
+
+  target = kmeans(nsamples, k, centers, counts);
+  for (c = 0; c < k; c++) {
+    printf("  cluster %d: %6d pixels, Y %5.1f Cb %5.1f Cr %5.1f%s\n", c, counts[c],
+           centers[c][0], centers[c][1], centers[c][2], c == target ? "  <- target" : "");
+  }
+  if (fit_gaussian(nsamples, target, &cal) < 0) {
+    fprintf(stderr, "Target cluster is empty\n");
+    exit(EXIT_FAILURE);
+  }
+  build_table(&cal, min_hits, lut);
+
+  // How well the table does on the pixels it was made from, and on the rest
+  cluster_hits = cluster_size = inner_hits = ninner = 0;
+  for (i = 0; i < nsamples; i++) {
+    int hit = table_hit(lut, samples[i].ycc);
+
+    if (cluster_of[i] == target) {
+      cluster_size++;
+      cluster_hits += hit;
+    }
+    if (samples[i].inner) {
+      ninner++;
+      inner_hits += hit;
+    }
+  }
+  for (i = 0; i < 32 * 32 * 32; i++) {
+    if ((lut[i >> 5] >> (i & 0x1F)) & 1) {
+      bg_hits += background[i];
+    }
+  }
+  printf("Table: %u cells, %.1f%% of the target cluster, %.1f%% of the rectangle's middle\n",
+         cal.cells, 100.0 * cluster_hits / cluster_size, ninner ? 100.0 * inner_hits / ninner : 0.0);
+  printf("Background: %.4f%% of pixels outside the rectangle hit, %.0f per frame\n",
+         nbackground ? 100.0 * bg_hits / nbackground : 0.0, nframes ? (double)bg_hits / nframes : 0.0);
+
+  if (classifier_save(out, &cal, lut) < 0) {
+    perror(out);
+    exit(EXIT_FAILURE);
+  }
+  printf("Wrote %s\n", out);
+  return 0;
+}
@@ -0,0 +1,309 @@
+// target_classify.c - per-pixel target color classifiers for the sentry.
+//
+// The reference rule converts every pixel to RGB and checks it against the
+// target box. The LUT classifier is built once from that rule and replaces
+// the conversion with a shift, a table load and a bit test. The YCC
+// classifier tests the same box as exact integer inequalities directly on
+// the packed words, four words at a time with NEON or SSE2.
+
+#include <stdio.h>
+#include <string.h>
+#include "sentry.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define TARGET_YCC_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define TARGET_YCC_SSE2
+#endif
+
+void YCbCr_to_RGB(int YCbCr[3], int RGB[3]) {
+    int R, G, B;
+
+    R = YCbCr[0] + 1.402 * (YCbCr[2] - 128);
+    G = YCbCr[0] - 0.344136 * (YCbCr[1] - 128) - 0.714136 * (YCbCr[2] - 128);
+    B = YCbCr[0] + 1.772 * (YCbCr[1] - 128);
+
+    // Clip the values
+    R = (R < 0) ? 0 : (R > 255) ? 255 : R;
+    G = (G < 0) ? 0 : (G > 255) ? 255 : G;
+    B = (B < 0) ? 0 : (B > 255) ? 255 : B;
+
+    RGB[0] = R;
+    RGB[1] = G;
+    RGB[2] = B;
+}
+
+// The original target test: convert to RGB and check the box
+int target_rgb_match(int Y, int Cb, int Cr) {
+  int YCbCr[3] = {Y, Cb, Cr};
+  int RGB[3];
+
+  YCbCr_to_RGB(YCbCr, RGB);
+  return (RGB[0] > TARGET_R_MIN && RGB[0] < TARGET_R_MAX) &&
+         (RGB[1] > TARGET_G_MIN && RGB[1] < TARGET_G_MAX) &&
+         (RGB[2] > TARGET_B_MIN && RGB[2] < TARGET_B_MAX);
+}
+
+static void classify_row_rgb(const classifier_t *c, const uint32_t *src, int nwords, uint8_t *mask) {
+  int col;
+
+  (void)c;
+  for (col = 0; col < nwords; col++) {
+    pix422_pair_t p = pix422_pair(src[col]);
+
+    mask[2 * col]     = target_rgb_match(p.y0, p.cb, p.cr);
+    mask[2 * col + 1] = target_rgb_match(p.y1, p.cb, p.cr);
+  }
+}
+
+static void classify_row_lut(const classifier_t *c, const uint32_t *src, int nwords, uint8_t *mask) {
+  const uint32_t *lut = c->lut;
+  int col;
+
+  for (col = 0; col < nwords; col++) {
+    uint32_t w = src[col];
+    uint32_t bits = lut[((w >> 6) & 0x3E0) | (w >> 27)];   // Cb[7:3], Cr[7:3]
+
+    mask[2 * col]     = (bits >> ((w >> 3) & 0x1F)) & 1;    // Y0[7:3]
+    mask[2 * col + 1] = (bits >> ((w >> 19) & 0x1F)) & 1;   // Y1[7:3]
+  }
+}
+
+// R, G and B before truncation, scaled to integers. Only the chroma terms
+// differ between the two pixels of a word.
+int target_ycc_match(int Y, int Cb, int Cr) {
+  int r = 1000 * Y + 1402 * (Cr - 128);
+  int g = 1000000 * Y - 344136 * (Cb - 128) - 714136 * (Cr - 128);
+  int b = 1000 * Y + 1772 * (Cb - 128);
+
+  return (r >= TARGET_YCC_R_LO && r < TARGET_YCC_R_HI) &&
+         (g >= TARGET_YCC_G_LO && g < TARGET_YCC_G_HI) &&
+         (b >= TARGET_YCC_B_LO && b < TARGET_YCC_B_HI);
+}
+
+static void classify_row_ycc_scalar(const uint32_t *src, int nwords, uint8_t *mask) {
+  int col;
+
+  for (col = 0; col < nwords; col++) {
+    pix422_pair_t p = pix422_pair(src[col]);
+
+    mask[2 * col]     = target_ycc_match(p.y0, p.cb, p.cr);
+    mask[2 * col + 1] = target_ycc_match(p.y1, p.cb, p.cr);
+  }
+}
+
+#if defined(TARGET_YCC_NEON)
+// lo <= v < hi as one unsigned compare
+#define YCC_IN_RANGE(v, lo, hi) vcltq_u32(vreinterpretq_u32_s32(vsubq_s32((v), vdupq_n_s32(lo))), vdupq_n_u32((hi) - (lo)))
+
+static void classify_row_ycc(const classifier_t *c, const uint32_t *src, int nwords, uint8_t *mask) {
+  const uint32x4_t byte_mask = vdupq_n_u32(0xFF);
+  const int32x4_t bias = vdupq_n_s32(128);
+  int col;
+
+  for (col = 0; col + 4 <= nwords; col += 4) {
+    uint32x4_t w = vld1q_u32(src + col);
+    int32x4_t y0 = vreinterpretq_s32_u32(vandq_u32(w, byte_mask));
+    int32x4_t y1 = vreinterpretq_s32_u32(vandq_u32(vshrq_n_u32(w, 16), byte_mask));
+    int32x4_t cb = vsubq_s32(vreinterpretq_s32_u32(vandq_u32(vshrq_n_u32(w, 8), byte_mask)), bias);
+    int32x4_t cr = vsubq_s32(vreinterpretq_s32_u32(vshrq_n_u32(w, 24)), bias);
+
+    int32x4_t rc = vmulq_n_s32(cr, 1402);
+    int32x4_t bc = vmulq_n_s32(cb, 1772);
+    int32x4_t gc = vmlaq_n_s32(vmulq_n_s32(cb, -344136), cr, -714136);
+
+    uint32x4_t m0 = vandq_u32(vandq_u32(YCC_IN_RANGE(vmlaq_n_s32(rc, y0, 1000), TARGET_YCC_R_LO, TARGET_YCC_R_HI),
+                                        YCC_IN_RANGE(vmlaq_n_s32(gc, y0, 1000000), TARGET_YCC_G_LO, TARGET_YCC_G_HI)),
+                              YCC_IN_RANGE(vmlaq_n_s32(bc, y0, 1000), TARGET_YCC_B_LO, TARGET_YCC_B_HI));
+    uint32x4_t m1 = vandq_u32(vandq_u32(YCC_IN_RANGE(vmlaq_n_s32(rc, y1, 1000), TARGET_YCC_R_LO, TARGET_YCC_R_HI),
+                                        YCC_IN_RANGE(vmlaq_n_s32(gc, y1, 1000000), TARGET_YCC_G_LO, TARGET_YCC_G_HI)),
+                              YCC_IN_RANGE(vmlaq_n_s32(bc, y1, 1000), TARGET_YCC_B_LO, TARGET_YCC_B_HI));
+
+    // Byte pair [m0][m1] per word, stored as four little-endian halfwords
+    uint32x4_t pairs = vorrq_u32(vandq_u32(m0, vdupq_n_u32(0x001)), vandq_u32(m1, vdupq_n_u32(0x100)));
+    vst1_u8(mask + 2 * col, vreinterpret_u8_u16(vmovn_u32(pairs)));
+  }
+  classify_row_ycc_scalar(src + col, nwords - col, mask + 2 * col);
+}
+#elif defined(TARGET_YCC_SSE2)
+// SSE2 has no 32-bit multiply, so products come from pmaddwd on (a, b)
+// halfword pairs. The G scale of 1e6 is applied as 1000 * 1000 by shifts.
+#define YCC_PAIR(a, b)  _mm_or_si128(_mm_and_si128((a), _mm_set1_epi32(0xFFFF)), _mm_slli_epi32((b), 16))
+#define YCC_COEF(a, b)  _mm_set1_epi32((int)(((uint32_t)(a) & 0xFFFF) | ((uint32_t)(b) << 16)))
+#define YCC_IN_RANGE(v, lo, hi) _mm_and_si128(_mm_cmpgt_epi32((v), _mm_set1_epi32((lo) - 1)), \
+                                              _mm_cmplt_epi32((v), _mm_set1_epi32(hi)))
+
+static inline __m128i ycc_mul1000(__m128i x) {
+  return _mm_sub_epi32(_mm_slli_epi32(x, 10), _mm_add_epi32(_mm_slli_epi32(x, 4), _mm_slli_epi32(x, 3)));
+}
+
+static void classify_row_ycc(const classifier_t *c, const uint32_t *src, int nwords, uint8_t *mask) {
+  const __m128i byte_mask = _mm_set1_epi32(0xFF);
+  const __m128i bias = _mm_set1_epi32(128);
+  const __m128i zero = _mm_setzero_si128();
+  int col;
+
+  (void)c;
+  for (col = 0; col + 4 <= nwords; col += 4) {
+    __m128i w = _mm_loadu_si128((const __m128i *)(src + col));
+    __m128i y0 = _mm_and_si128(w, byte_mask);
+    __m128i y1 = _mm_and_si128(_mm_srli_epi32(w, 16), byte_mask);
+    __m128i cb = _mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(w, 8), byte_mask), bias);
+    __m128i cr = _mm_sub_epi32(_mm_srli_epi32(w, 24), bias);
+
+    // 1e6 Y - 344136 Cb - 714136 Cr = 1000 (1000 Y - 344 Cb - 714 Cr) - 136 (Cb + Cr)
+    __m128i gc = _mm_madd_epi16(YCC_PAIR(cb, cr), YCC_COEF(-344, -714));
+    __m128i gs = _mm_madd_epi16(YCC_PAIR(_mm_add_epi32(cb, cr), zero), YCC_COEF(136, 0));
+
+    __m128i r0 = _mm_madd_epi16(YCC_PAIR(y0, cr), YCC_COEF(1000, 1402));
+    __m128i b0 = _mm_madd_epi16(YCC_PAIR(y0, cb), YCC_COEF(1000, 1772));
+    __m128i g0 = _mm_sub_epi32(ycc_mul1000(_mm_add_epi32(_mm_madd_epi16(YCC_PAIR(y0, zero), YCC_COEF(1000, 0)), gc)), gs);
+    __m128i r1 = _mm_madd_epi16(YCC_PAIR(y1, cr), YCC_COEF(1000, 1402));
+    __m128i b1 = _mm_madd_epi16(YCC_PAIR(y1, cb), YCC_COEF(1000, 1772));
+    __m128i g1 = _mm_sub_epi32(ycc_mul1000(_mm_add_epi32(_mm_madd_epi16(YCC_PAIR(y1, zero), YCC_COEF(1000, 0)), gc)), gs);
+
+    __m128i m0 = _mm_and_si128(_mm_and_si128(YCC_IN_RANGE(r0, TARGET_YCC_R_LO, TARGET_YCC_R_HI),
+                                             YCC_IN_RANGE(g0, TARGET_YCC_G_LO, TARGET_YCC_G_HI)),
+                               YCC_IN_RANGE(b0, TARGET_YCC_B_LO, TARGET_YCC_B_HI));
+    __m128i m1 = _mm_and_si128(_mm_and_si128(YCC_IN_RANGE(r1, TARGET_YCC_R_LO, TARGET_YCC_R_HI),
+                                             YCC_IN_RANGE(g1, TARGET_YCC_G_LO, TARGET_YCC_G_HI)),
+                               YCC_IN_RANGE(b1, TARGET_YCC_B_LO, TARGET_YCC_B_HI));
+
+    // Byte pair [m0][m1] per word, stored as four little-endian halfwords
+    __m128i pairs = _mm_or_si128(_mm_and_si128(m0, _mm_set1_epi32(0x001)), _mm_and_si128(m1, _mm_set1_epi32(0x100)));
+    _mm_storel_epi64((__m128i *)(mask + 2 * col), _mm_packs_epi32(pairs, zero));
+  }
+  classify_row_ycc_scalar(src + col, nwords - col, mask + 2 * col);
+}
+#else
+static void classify_row_ycc(const classifier_t *c, const uint32_t *src, int nwords, uint8_t *mask) {
+  (void)c;
+  classify_row_ycc_scalar(src, nwords, mask);
+}
+#endif
+
+// A cell's bit is set when enough of its 8x8x8 colors pass the reference
+// rule. The box is thin compared to a cell, so a majority vote would drop
+// over a third of the target colors.
+static void build_lut(uint32_t *lut) {
+  static uint16_t hits[32 * 32 * 32];
+  int Y, Cb, Cr, i;
+
+  memset(hits, 0, sizeof(hits));
+  for (Y = 0; Y < 256; Y++) {
+    for (Cb = 0; Cb < 256; Cb++) {
+      for (Cr = 0; Cr < 256; Cr++) {
+        if (target_rgb_match(Y, Cb, Cr)) {
+          hits[((Cb >> 3) << 10) | ((Cr >> 3) << 5) | (Y >> 3)]++;
+        }
+      }
+    }
+  }
+
+  memset(lut, 0, TARGET_LUT_WORDS * sizeof(uint32_t));
+  for (i = 0; i < 32 * 32 * 32; i++) {
+    if (hits[i] >= TARGET_LUT_MIN_HITS) {
+      lut[i >> 5] |= 1u << (i & 0x1F);
+    }
+  }
+}
+
+int classifier_init(classifier_t *c, classify_mode_t mode) {
+  c->mode = mode;
+  switch (mode) {
+    case CLASSIFY_RGB:
+      c->classify_row = classify_row_rgb;
+      break;
+    case CLASSIFY_LUT:
+      build_lut(c->lut);
+      c->classify_row = classify_row_lut;
+      break;
+    case CLASSIFY_YCC:
+      c->classify_row = classify_row_ycc;
+      break;
+    default:
+      return -1;
+  }
+  return 0;
+}
+
+// Use a table made by target_calibrate instead of the built-in rule
+int classifier_load(classifier_t *c, const char *path, target_cal_t *cal) {
+  FILE *f;
+  int ok;
+
+  if ((f = fopen(path, "rb")) == NULL) {
+    return -1;
+  }
+  ok = fread(cal, sizeof(*cal), 1, f) == 1 &&
+       cal->magic == TARGET_CAL_MAGIC && cal->words == TARGET_LUT_WORDS &&
+       fread(c->lut, sizeof(uint32_t), TARGET_LUT_WORDS, f) == TARGET_LUT_WORDS;
+  fclose(f);
+  if (!ok) {
+    return -1;
+  }
+
+  c->mode = CLASSIFY_LUT;
+  c->classify_row = classify_row_lut;
+  return 0;
+}
+
+int classifier_save(const char *path, const target_cal_t *cal, const uint32_t *lut) {
+  FILE *f;
+  int ok;
+
+  if ((f = fopen(path, "wb")) == NULL) {
+    return -1;
+  }
+  ok = fwrite(cal, sizeof(*cal), 1, f) == 1 &&
+       fwrite(lut, sizeof(uint32_t), TARGET_LUT_WORDS, f) == TARGET_LUT_WORDS;
+  if (fclose(f) != 0) {
+    ok = 0;
+  }
+  return ok ? 0 : -1;
+}
+
+const char *classifier_name(classify_mode_t mode) {
+  switch (mode) {
+    case CLASSIFY_RGB: return "rgb";
+    case CLASSIFY_LUT: return "lut";
+    case CLASSIFY_YCC: return "ycc";
+  }
+  return "?";
+}
+
+// Check the YCC classifier against the YCbCr_to_RGB() rule for every one of
+// the 2^24 colors, both the scalar test and the row classifier (each color
+// goes through the Y0 lane of one word and the Y1 lane of another).
+// Returns the number of disagreements.
+long classifier_verify(void) {
+  classifier_t c;
+  uint32_t words[256];
+  uint8_t mask[512];
+  long scalar_errors = 0, row_errors = 0, matches = 0;
+  int Y, Cb, Cr, ref;
+
+  classifier_init(&c, CLASSIFY_YCC);
+  for (Cr = 0; Cr < 256; Cr++) {
+    for (Cb = 0; Cb < 256; Cb++) {
+      for (Y = 0; Y < 256; Y++) {
+        words[Y] = pix422_word(Y, Cb, 255 - Y, Cr);
+      }
+      c.classify_row(&c, words, 256, mask);
+
+      for (Y = 0; Y < 256; Y++) {
+        ref = target_rgb_match(Y, Cb, Cr);
+        matches += ref;
+        scalar_errors += (target_ycc_match(Y, Cb, Cr) != ref);
+        row_errors += (mask[2 * Y] != ref);
+        row_errors += (mask[2 * (255 - Y) + 1] != ref);
+      }
+    }
+  }
+
+  printf("Verified 16777216 colors (%ld target): %ld scalar and %ld row mismatches\n",
+         matches, scalar_errors, row_errors);
+  return scalar_errors + row_errors;
+}
@@ -0,0 +1,432 @@
+// template_match.c - find a printed target pattern by normalized
+// cross-correlation (NCC) of the Y plane.
+//
+// Every frame is reduced to a pyramid of Y planes at 1/2, 1/4, 1/8 and 1/16
+// resolution, each level the rounded 2x2 mean of the one above it (level 1
+// straight from the 4:2:2 words). The template is reduced the same way
+// when it is loaded, and each level of it is stored with its mean taken
+// out, together with its norm.
+//
+// NCC is searched over the whole image only at the coarsest level at which
+// the template is still TEMPLATE_MIN_COARSE pixels across. The best few
+// peaks, TEMPLATE_CANDIDATES of them, are kept, each suppressing its
+// neighbourhood. Each one is then followed down the pyramid, and at every
+// finer level only +-TEMPLATE_REFINE positions around it are tried.
+//
+// At each position the template dot product and the window's sum and sum
+// of squares come from the same pass over the window, eight pixels at a
+// time in 16-bit lanes with NEON or SSE2. Because the template has zero
+// mean, the image mean never has to be subtracted (bar the template's
+// rounding, which the window sum corrects for).
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sentry.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define TEMPLATE_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define TEMPLATE_SSE2
+#endif
+
+#define TEMPLATE_SLACK             16   // Bytes past each level, for 8-wide loads
+
+// Level 1 row y from frame rows 2y and 2y + 1: the two rows averaged, then
+// each word's two Y samples. Every reduction rounds rows first, so the SIMD
+// and scalar paths agree exactly.
+void template_reduce_frame_row(const uint32_t *a, const uint32_t *b, uint8_t *out) {
+  int i = 0;
+
+#if defined(TEMPLATE_NEON)
+  for (; i + 8 <= FRAME_WORDS_PER_ROW; i += 8) {
+    uint8x8x4_t va = vld4_u8((const uint8_t *)(a + i));   // Y0, Cb, Y1, Cr
+    uint8x8x4_t vb = vld4_u8((const uint8_t *)(b + i));
+
+    vst1_u8(out + i, vrhadd_u8(vrhadd_u8(va.val[0], vb.val[0]), vrhadd_u8(va.val[2], vb.val[2])));
+  }
+#elif defined(TEMPLATE_SSE2)
+  const __m128i lo = _mm_set1_epi32(0xFF);
+
+  for (; i + 8 <= FRAME_WORDS_PER_ROW; i += 8) {
+    __m128i v[2];
+
+    for (int k = 0; k < 2; k++) {
+      __m128i rows = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(a + i + 4 * k)),
+                                  _mm_loadu_si128((const __m128i *)(b + i + 4 * k)));
+      __m128i y0 = _mm_and_si128(rows, lo);
+      __m128i y1 = _mm_and_si128(_mm_srli_epi32(rows, 16), lo);
+
+      v[k] = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(y0, y1), _mm_set1_epi32(1)), 1);
+    }
+    _mm_storel_epi64((__m128i *)(out + i), _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]), _mm_setzero_si128()));
+  }
+#endif
+  for (; i < FRAME_WORDS_PER_ROW; i++) {
+    int y0 = (pix422_y0(a[i]) + pix422_y0(b[i]) + 1) >> 1;
+    int y1 = (pix422_y1(a[i]) + pix422_y1(b[i]) + 1) >> 1;
+
+    out[i] = (y0 + y1 + 1) >> 1;
+  }
+}
+
+// Halve a level: out[i] from the 2x2 block at a[2i], b[2i]
+void template_reduce_row(const uint8_t *a, const uint8_t *b, uint8_t *out, int n) {
+  int i = 0;
+
+#if defined(TEMPLATE_NEON)
+  for (; i + 8 <= n; i += 8) {
+    uint8x8x2_t va = vld2_u8(a + 2 * i);
+    uint8x8x2_t vb = vld2_u8(b + 2 * i);
+
+    vst1_u8(out + i, vrhadd_u8(vrhadd_u8(va.val[0], vb.val[0]), vrhadd_u8(va.val[1], vb.val[1])));
+  }
+#elif defined(TEMPLATE_SSE2)
+  const __m128i lo = _mm_set1_epi16(0xFF);
+  const __m128i one = _mm_set1_epi16(1);
+
+  for (; i + 8 <= n; i += 8) {
+    __m128i rows = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(a + 2 * i)),
+                                _mm_loadu_si128((const __m128i *)(b + 2 * i)));
+    __m128i even = _mm_and_si128(rows, lo);
+    __m128i odd = _mm_srli_epi16(rows, 8);
+    __m128i v = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(even, odd), one), 1);
+
+    _mm_storel_epi64((__m128i *)(out + i), _mm_packus_epi16(v, _mm_setzero_si128()));
+  }
+#endif
+  for (; i < n; i++) {
+    out[i] = ((((a[2 * i] + b[2 * i] + 1) >> 1) + ((a[2 * i + 1] + b[2 * i + 1] + 1) >> 1) + 1) >> 1);
+  }
+}
+
+// Dot product of the zero-mean template level with the window at img, and
+// the window's sum and sum of squares
+static void template_window(const template_level_t *t, const uint8_t *img, int stride,
+                            int32_t *dot, int32_t *sum, int32_t *sumsq) {
+#if defined(TEMPLATE_NEON)
+  int32x4_t vdot = vdupq_n_s32(0), vsq = vdupq_n_s32(0);
+  uint32x4_t vsum = vdupq_n_u32(0);
+
+  for (int r = 0; r < t->height; r++) {
+    const int16_t *tr = &t->t[r * t->stride];
+    const int16_t *mr = &t->mask[r * t->stride];
+    const uint8_t *ir = &img[r * stride];
+
+    for (int c = 0; c < t->stride; c += 8) {
+      int16x8_t v = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(ir + c)));
+      int16x8_t tv = vld1q_s16(tr + c);
+      int16x8_t m = vandq_s16(v, vld1q_s16(mr + c));
+
+      vdot = vmlal_s16(vdot, vget_low_s16(tv), vget_low_s16(v));
+      vdot = vmlal_s16(vdot, vget_high_s16(tv), vget_high_s16(v));
+      vsq = vmlal_s16(vsq, vget_low_s16(m), vget_low_s16(v));
+      vsq = vmlal_s16(vsq, vget_high_s16(m), vget_high_s16(v));
+      vsum = vpadalq_u16(vsum, vreinterpretq_u16_s16(m));
+    }
+  }
+  *dot = vgetq_lane_s32(vdot, 0) + vgetq_lane_s32(vdot, 1) + vgetq_lane_s32(vdot, 2) + vgetq_lane_s32(vdot, 3);
+  *sumsq = vgetq_lane_s32(vsq, 0) + vgetq_lane_s32(vsq, 1) + vgetq_lane_s32(vsq, 2) + vgetq_lane_s32(vsq, 3);
+  *sum = vgetq_lane_u32(vsum, 0) + vgetq_lane_u32(vsum, 1) + vgetq_lane_u32(vsum, 2) + vgetq_lane_u32(vsum, 3);
+#elif defined(TEMPLATE_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+  __m128i vdot = zero, vsum = zero, vsq = zero;
+  int32_t lanes[3][4];
+
+  for (int r = 0; r < t->height; r++) {
+    const int16_t *tr = &t->t[r * t->stride];
+    const int16_t *mr = &t->mask[r * t->stride];
+    const uint8_t *ir = &img[r * stride];
+
+    for (int c = 0; c < t->stride; c += 8) {
+      __m128i v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(ir + c)), zero);
+      __m128i m = _mm_and_si128(v, _mm_loadu_si128((const __m128i *)(mr + c)));
+
+      vdot = _mm_add_epi32(vdot, _mm_madd_epi16(v, _mm_loadu_si128((const __m128i *)(tr + c))));
+      vsum = _mm_add_epi32(vsum, _mm_madd_epi16(m, ones));
+      vsq = _mm_add_epi32(vsq, _mm_madd_epi16(m, v));
+    }
+  }
+  _mm_storeu_si128((__m128i *)lanes[0], vdot);
+  _mm_storeu_si128((__m128i *)lanes[1], vsum);
+  _mm_storeu_si128((__m128i *)lanes[2], vsq);
+  *dot = lanes[0][0] + lanes[0][1] + lanes[0][2] + lanes[0][3];
+  *sum = lanes[1][0] + lanes[1][1] + lanes[1][2] + lanes[1][3];
+  *sumsq = lanes[2][0] + lanes[2][1] + lanes[2][2] + lanes[2][3];
+#else
+  int32_t d = 0, s = 0, q = 0;
+
+  for (int r = 0; r < t->height; r++) {
+    for (int c = 0; c < t->width; c++) {
+      int v = img[r * stride + c];
+
+      d += t->t[r * t->stride + c] * v;
+      s += v;
+      q += v * v;
+    }
+  }
+  *dot = d;
+  *sum = s;
+  *sumsq = q;
+#endif
+}
+
+// NCC of the template level with the window whose top left is (x, y)
+static double template_ncc(const template_level_t *t, const uint8_t *img, int stride, int x, int y) {
+  int32_t dot, sum, sumsq;
+  double var;
+
+  template_window(t, &img[y * stride + x], stride, &dot, &sum, &sumsq);
+  var = sumsq - (double)sum * sum / t->n;
+  // A flat window matches nothing
+  if (var < t->n) {
+    return 0;
+  }
+  // The rounded template sums to tsum rather than exactly 0
+  return (dot - (double)sum * t->tsum / t->n) / (t->norm * sqrt(var));
+}
+
+// Store one reduced template level: mean taken out, rows padded with zeros
+// to whole vectors, and a mask that is -1 over the real pixels
+static int template_level_init(template_level_t *t, const uint8_t *pix, int width, int height) {
+  double mean = 0, sq = 0;
+
+  t->width = width;
+  t->height = height;
+  t->stride = (width + 7) & ~7;
+  t->n = width * height;
+  t->tsum = 0;
+  t->t = calloc(t->stride * height, sizeof(int16_t));
+  t->mask = calloc(t->stride * height, sizeof(int16_t));
+  if (t->t == NULL || t->mask == NULL) {
+    return -1;
+  }
+  for (int i = 0; i < t->n; i++) {
+    mean += pix[i];
+  }
+  mean /= t->n;
+  for (int r = 0; r < height; r++) {
+    for (int c = 0; c < width; c++) {
+      int v = (int)lrint(pix[r * width + c] - mean);
+
+      t->t[r * t->stride + c] = v;
+      t->mask[r * t->stride + c] = -1;
+      t->tsum += v;
+      sq += (double)v * v;
+    }
+  }
+  t->norm = sqrt(sq);
+  return 0;
+}
+
+// Cut the template out of the first frame of a raw 4:2:2 file. Returns -1
+// on a bad file or rectangle, or a pattern too flat to correlate.
+int template_load(matcher_t *m, const char *path, const scan_window_t *rect) {
+  static uint32_t row[FRAME_WORDS_PER_ROW];
+  int width = (rect->x1 - rect->x0) & ~1;
+  int height = rect->y1 - rect->y0;
+  uint8_t *pix[TEMPLATE_LEVELS + 1];
+  int w, h, fd, l;
+
+  memset(m, 0, sizeof(*m));
+  if (rect->x0 < 0 || rect->y0 < 0 || rect->x1 > DISP_WIDTH || rect->y1 > DISP_HEIGHT ||
+      width < 2 * TEMPLATE_MIN_COARSE || height < 2 * TEMPLATE_MIN_COARSE ||
+      width > TEMPLATE_MAX_SIZE || height > TEMPLATE_MAX_SIZE) {
+    fprintf(stderr, "Template must be %d to %d pixels across, inside the frame\n",
+            2 * TEMPLATE_MIN_COARSE, TEMPLATE_MAX_SIZE);
+    return -1;
+  }
+  if ((fd = open(path, O_RDONLY)) < 0) {
+    perror(path);
+    return -1;
+  }
+  if ((pix[0] = malloc(width * height)) == NULL) {
+    close(fd);
+    return -1;
+  }
+  for (int r = 0; r < height; r++) {
+    off_t off = ((off_t)(rect->y0 + r) * FRAME_WORDS_PER_ROW + rect->x0 / 2) * 4;
+
+    if (pread(fd, row, width * 2, off) != width * 2) {
+      fprintf(stderr, "%s holds no whole %dx%d 4:2:2 frame\n", path, DISP_WIDTH, DISP_HEIGHT);
+      close(fd);
+      return -1;
+    }
+    pix422_unpack_y(row, width / 2, &pix[0][r * width]);
+  }
+  close(fd);
+
+  // The template's own pyramid, down to where it would get too small
+  m->width = width;
+  m->height = height;
+  w = width;
+  h = height;
+  for (l = 1; l <= TEMPLATE_LEVELS; l++) {
+    if ((w / 2) < TEMPLATE_MIN_COARSE || (h / 2) < TEMPLATE_MIN_COARSE) {
+      break;
+    }
+    if ((pix[l] = malloc((w / 2) * (h / 2))) == NULL) {
+      return -1;
+    }
+    for (int r = 0; r < h / 2; r++) {
+      for (int c = 0; c < w / 2; c++) {
+        const uint8_t *p = &pix[l - 1][2 * r * w + 2 * c];
+
+        pix[l][r * (w / 2) + c] = ((((p[0] + p[w] + 1) >> 1) + ((p[1] + p[w + 1] + 1) >> 1) + 1) >> 1);
+      }
+    }
+    w /= 2;
+    h /= 2;
+    if (template_level_init(&m->level[l], pix[l], w, h) < 0 || m->level[l].norm < sqrt(w * h)) {
+      fprintf(stderr, "Template is too flat to match\n");
+      return -1;
+    }
+  }
+  m->coarse = l - 1;
+  for (l = 0; l <= m->coarse; l++) {
+    free(pix[l]);
+  }
+  if (m->coarse < 1) {
+    fprintf(stderr, "Template is too small\n");
+    return -1;
+  }
+
+  for (l = 1; l <= m->coarse; l++) {
+    m->pyr[l] = malloc((DISP_WIDTH >> l) * (DISP_HEIGHT >> l) + TEMPLATE_SLACK);
+    if (m->pyr[l] == NULL) {
+      fprintf(stderr, "Out of memory\n");
+      return -1;
+    }
+  }
+  m->score_map = malloc((DISP_WIDTH >> m->coarse) * (DISP_HEIGHT >> m->coarse) * sizeof(float));
+  return (m->score_map != NULL) ? 0 : -1;
+}
+
+// Reduce the frame down to the coarsest level the template is searched at
+static void template_pyramid(matcher_t *m, const uint32_t *frame) {
+  for (int y = 0; y < DISP_HEIGHT / 2; y++) {
+    template_reduce_frame_row(&frame[2 * y * FRAME_WORDS_PER_ROW], &frame[(2 * y + 1) * FRAME_WORDS_PER_ROW],
+                              &m->pyr[1][y * (DISP_WIDTH / 2)]);
+  }
+  for (int l = 2; l <= m->coarse; l++) {
+    int w = DISP_WIDTH >> l, h = DISP_HEIGHT >> l;
+
+    for (int y = 0; y < h; y++) {
+      template_reduce_row(&m->pyr[l - 1][2 * y * 2 * w], &m->pyr[l - 1][(2 * y + 1) * 2 * w], &m->pyr[l][y * w], w);
+    }
+  }
+}
+
+// Look for the template in a frame. A match is reported as one blob the
+// size of the template, so the tracker can follow it like any other.
+void template_scan(matcher_t *m, const uint32_t *frame, scan_result_t *r) {
+  const template_level_t *t = &m->level[m->coarse];
+  int w = DISP_WIDTH >> m->coarse, h = DISP_HEIGHT >> m->coarse;
+  int nx = w - t->width + 1, ny = h - t->height + 1;
+  int cand_x[TEMPLATE_CANDIDATES], cand_y[TEMPLATE_CANDIDATES];
+  int ncand = 0;
+  int best_x = 0, best_y = 0;
+  double best = -1;
+  int64_t area;
+  blob_t *b;
+
+  memset(r, 0, sizeof(*r));
+  template_pyramid(m, frame);
+
+  // Whole image at the coarsest level
+  for (int y = 0; y < ny; y++) {
+    for (int x = 0; x < nx; x++) {
+      m->score_map[y * nx + x] = template_ncc(t, m->pyr[m->coarse], w, x, y);
+    }
+  }
+
+  // The highest peaks, each clearing its template-sized neighbourhood
+  while (ncand < TEMPLATE_CANDIDATES) {
+    float peak = TEMPLATE_MIN_COARSE_SCORE;
+    int px = -1, py = -1;
+
+    for (int i = 0; i < nx * ny; i++) {
+      if (m->score_map[i] > peak) {
+        peak = m->score_map[i];
+        px = i % nx;
+        py = i / nx;
+      }
+    }
+    if (px < 0) {
+      break;
+    }
+    cand_x[ncand] = px;
+    cand_y[ncand++] = py;
+    for (int y = py - t->height / 2; y <= py + t->height / 2; y++) {
+      for (int x = px - t->width / 2; x <= px + t->width / 2; x++) {
+        if (x >= 0 && x < nx && y >= 0 && y < ny) {
+          m->score_map[y * nx + x] = -1;
+        }
+      }
+    }
+  }
+
+  // Follow each candidate down to level 1
+  for (int k = 0; k < ncand; k++) {
+    int x = cand_x[k], y = cand_y[k];
+    double score = 0;
+
+    for (int l = m->coarse - 1; l >= 1; l--) {
+      const template_level_t *tl = &m->level[l];
+      int lw = DISP_WIDTH >> l, lh = DISP_HEIGHT >> l;
+      int cx = 2 * x, cy = 2 * y;
+
+      score = -1;
+      for (int yy = cy - TEMPLATE_REFINE; yy <= cy + TEMPLATE_REFINE; yy++) {
+        for (int xx = cx - TEMPLATE_REFINE; xx <= cx + TEMPLATE_REFINE; xx++) {
+          double s;
+
+          if (xx < 0 || yy < 0 || xx + tl->width > lw || yy + tl->height > lh) {
+            continue;
+          }
+          s = template_ncc(tl, m->pyr[l], lw, xx, yy);
+          if (s > score) {
+            score = s;
+            x = xx;
+            y = yy;
+          }
+        }
+      }
+    }
+    if (m->coarse == 1) {
+      score = template_ncc(t, m->pyr[1], w, x, y);
+    }
+    if (score > best) {
+      best = score;
+      best_x = x;
+      best_y = y;
+    }
+  }
+  r->tiles = 0;
+  r->components = ncand;
+  m->score = best;
+  if (best < TEMPLATE_MIN_SCORE) {
+    return;
+  }
+
+  // Level 1 is half resolution
+  area = (int64_t)m->width * m->height;
+  b = &r->blobs[0];
+  b->area = (int)area;
+  b->x_min = 2 * best_x;
+  b->x_max = 2 * best_x + m->width - 1;
+  b->y_min = 2 * best_y;
+  b->y_max = 2 * best_y + m->height - 1;
+  b->x_sum = (int64_t)((2 * best_x + (m->width - 1) / 2.0) * area);
+  b->y_sum = (int64_t)((2 * best_y + (m->height - 1) / 2.0) * area);
+  r->nblobs = 1;
+  r->count = b->area;
+  r->x_sum = b->x_sum;
+  r->y_sum = b->y_sum;
+}
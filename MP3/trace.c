@@ -0,0 +1,200 @@
+// trace.c - record where the sentry's reaction time goes, for
+// chrome://tracing or Perfetto.
+//
+// Each thread writes its events to a buffer of its own, taken from a fixed
+// table the first time it records anything. Only that thread ever writes
+// the buffer, and it publishes each event by bumping the buffer's count
+// with a release store, so recording takes no lock and never waits on
+// another thread. A full buffer drops events and counts them.
+//
+// Spans are recorded when they end, with their start time, as Chrome
+// "complete" events. A command's path from the detector to the actuator
+// thread is drawn as a flow arrow, by its sequence number. Nothing is
+// recorded until trace_open, and each call is then a clock read and a
+// store. trace_close writes the whole trace out as JSON.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sentry.h"
+
+typedef struct {
+  const char *name;             // Static strings only
+  const char *arg_name;         // NULL for none
+  int64_t start_ns, dur_ns;
+  int arg;                      // Or the flow id
+  char phase;                   // 'X' span, 'i' instant, 's'/'f' flow start/end
+} trace_event_t;
+
+typedef struct {
+  int tid;
+  const char *name;
+  int dropped;
+  _Atomic int count;
+  trace_event_t events[TRACE_EVENTS];
+} trace_buf_t;
+
+static struct {
+  atomic_int enabled;
+  const char *path;
+  int64_t t0_ns;
+  atomic_int nbufs;
+  trace_buf_t *_Atomic bufs[TRACE_MAX_THREADS];
+} trace;
+
+static _Thread_local trace_buf_t *trace_self;
+static _Thread_local int trace_no_buf;
+
+int64_t trace_now(void) {
+  struct timespec ts;
+
+  if (!atomic_load_explicit(&trace.enabled, memory_order_relaxed)) {
+    return 0;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// The calling thread's buffer, NULL if the table is full
+static trace_buf_t *trace_buf(void) {
+  int slot;
+
+  if (trace_self != NULL || trace_no_buf) {
+    return trace_self;
+  }
+  slot = atomic_fetch_add(&trace.nbufs, 1);
+  if (slot >= TRACE_MAX_THREADS || (trace_self = calloc(1, sizeof(trace_buf_t))) == NULL) {
+    trace_no_buf = 1;
+    return NULL;
+  }
+  trace_self->tid = slot + 1;
+  atomic_store_explicit(&trace.bufs[slot], trace_self, memory_order_release);
+  return trace_self;
+}
+
+static void trace_add(char phase, const char *name, int64_t start_ns, int64_t dur_ns, const char *arg_name,
+                      int arg) {
+  trace_buf_t *b;
+  trace_event_t *e;
+  int n;
+
+  if (!atomic_load_explicit(&trace.enabled, memory_order_relaxed) || (b = trace_buf()) == NULL) {
+    return;
+  }
+  n = atomic_load_explicit(&b->count, memory_order_relaxed);
+  if (n == TRACE_EVENTS) {
+    b->dropped++;
+    return;
+  }
+  e = &b->events[n];
+  *e = (trace_event_t){name, arg_name, start_ns, dur_ns, arg, phase};
+  atomic_store_explicit(&b->count, n + 1, memory_order_release);
+}
+
+// Start recording, to be written to path by trace_close
+int trace_open(const char *path) {
+  FILE *f = fopen(path, "w");
+
+  if (f == NULL) {
+    perror(path);
+    return -1;
+  }
+  fclose(f);
+  trace.path = path;
+  atomic_store(&trace.enabled, 1);
+  trace.t0_ns = trace_now();
+  return 0;
+}
+
+// Name the calling thread in the trace
+void trace_thread_name(const char *name) {
+  trace_buf_t *b;
+
+  if (atomic_load_explicit(&trace.enabled, memory_order_relaxed) && (b = trace_buf()) != NULL) {
+    b->name = name;
+  }
+}
+
+// A span from start (a trace_now) until now
+void trace_span(const char *name, int64_t start, const char *arg_name, int arg) {
+  int64_t end = trace_now();
+
+  trace_add('X', name, start, end - start, arg_name, arg);
+}
+
+void trace_mark(const char *name, const char *arg_name, int arg) {
+  trace_add('i', name, trace_now(), 0, arg_name, arg);
+}
+
+// One end of an arrow from one thread's span to another's: at the start of
+// the span the calling thread is in (start) or the end of it (!start)
+void trace_flow(const char *name, int start, unsigned id) {
+  trace_add(start ? 's' : 'f', name, trace_now(), 0, NULL, (int)id);
+}
+
+static void trace_write_event(FILE *f, int tid, const trace_event_t *e, int *first) {
+  fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%.3f", *first ? "" : ",", e->name,
+          e->phase, tid, (e->start_ns - trace.t0_ns) / 1e3);
+  *first = 0;
+  switch (e->phase) {
+    case 'X':
+      fprintf(f, ",\"dur\":%.3f", e->dur_ns / 1e3);
+      break;
+    case 'i':
+      fprintf(f, ",\"s\":\"t\"");
+      break;
+    case 's':
+    case 'f':
+      fprintf(f, ",\"cat\":\"cmd\",\"id\":%d%s", e->arg, e->phase == 'f' ? ",\"bp\":\"e\"" : "");
+      break;
+  }
+  if (e->arg_name != NULL) {
+    fprintf(f, ",\"args\":{\"%s\":%d}", e->arg_name, e->arg);
+  }
+  fprintf(f, "}");
+}
+
+// Stop recording and write the trace. Call once the other threads have
+// stopped recording, or their latest events may be missed.
+int trace_close(void) {
+  int nbufs, events = 0, dropped = 0, first = 1;
+  FILE *f;
+
+  if (!atomic_exchange(&trace.enabled, 0)) {
+    return 0;
+  }
+  if ((f = fopen(trace.path, "w")) == NULL) {
+    perror(trace.path);
+    return -1;
+  }
+  fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  nbufs = atomic_load(&trace.nbufs);
+  nbufs = (nbufs > TRACE_MAX_THREADS) ? TRACE_MAX_THREADS : nbufs;
+  for (int i = 0; i < nbufs; i++) {
+    trace_buf_t *b = atomic_load_explicit(&trace.bufs[i], memory_order_acquire);
+    int n;
+
+    if (b == NULL) {
+      continue;
+    }
+    n = atomic_load_explicit(&b->count, memory_order_acquire);
+    if (b->name != NULL) {
+      fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+              first ? "" : ",", b->tid, b->name);
+      first = 0;
+    }
+    for (int k = 0; k < n; k++) {
+      trace_write_event(f, b->tid, &b->events[k], &first);
+    }
+    events += n;
+    dropped += b->dropped;
+  }
+  fprintf(f, "\n]}\n");
+  if (fclose(f) != 0) {
+    perror(trace.path);
+    return -1;
+  }
+  printf("Trace: %d events from %d threads to %s (%d dropped)\n", events, nbufs, trace.path, dropped);
+  return 0;
+}
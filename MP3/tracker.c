@@ -0,0 +1,205 @@
+// tracker.c - multi-target tracker over the blobs found in each frame.
+//
+// Each track runs a constant-velocity Kalman filter per axis (position and
+// velocity in pixels and pixels/s, the axes kept independent). Every frame
+// the tracks are predicted to the frame time, detections are assigned to
+// them greedily by gated Mahalanobis distance, and unassigned detections
+// start new tracks. A track is confirmed after TRACK_CONFIRM hits and
+// dropped after TRACK_MAX_MISSES frames without one, so IDs persist while
+// the target stays in view. All of this is O(tracks x blobs).
+
+#include <math.h>
+#include <string.h>
+#include "sentry.h"
+
+static void kalman_init(kalman_axis_t *k, double pos) {
+  k->pos = pos;
+  k->vel = 0;
+  k->p00 = TRACK_MEAS_VAR;
+  k->p01 = 0;
+  k->p11 = TRACK_INIT_VEL_VAR;
+}
+
+// x' = F x, P' = F P F^T + Q for F = [1 dt; 0 1] and a white acceleration
+// of variance TRACK_ACCEL_VAR
+static void kalman_predict(kalman_axis_t *k, double dt) {
+  double dt2 = dt * dt;
+
+  k->pos += k->vel * dt;
+  k->p00 += 2 * dt * k->p01 + dt2 * k->p11 + TRACK_ACCEL_VAR * dt2 * dt2 / 4;
+  k->p01 += dt * k->p11 + TRACK_ACCEL_VAR * dt2 * dt / 2;
+  k->p11 += TRACK_ACCEL_VAR * dt2;
+}
+
+static void kalman_correct(kalman_axis_t *k, double meas) {
+  double s = k->p00 + TRACK_MEAS_VAR;
+  double k0 = k->p00 / s;
+  double k1 = k->p01 / s;
+  double innov = meas - k->pos;
+
+  k->pos += k0 * innov;
+  k->vel += k1 * innov;
+  k->p11 -= k1 * k->p01;
+  k->p01 -= k0 * k->p01;
+  k->p00 -= k0 * k->p00;
+}
+
+// Squared Mahalanobis distance of a detection from the predicted position
+static double track_distance(const track_t *t, double x, double y) {
+  double dx = x - t->x.pos;
+  double dy = y - t->y.pos;
+
+  return dx * dx / (t->x.p00 + TRACK_MEAS_VAR) + dy * dy / (t->y.p00 + TRACK_MEAS_VAR);
+}
+
+static void track_set_size(track_t *t, const blob_t *b) {
+  t->area = b->area;
+  t->width = b->x_max - b->x_min + 1;
+  t->height = b->y_max - b->y_min + 1;
+}
+
+void tracker_init(tracker_t *tr) {
+  memset(tr, 0, sizeof(*tr));
+  tr->next_id = 1;
+}
+
+void tracker_update(tracker_t *tr, const blob_t *blobs, int nblobs, double dt) {
+  double dist[TRACK_MAX][BLOB_MAX];
+  int det_used[BLOB_MAX] = {0};
+  int trk_used[TRACK_MAX] = {0};
+  double cx[BLOB_MAX], cy[BLOB_MAX];
+  int i, j, n;
+
+  for (j = 0; j < nblobs; j++) {
+    cx[j] = (double)blobs[j].x_sum / blobs[j].area;
+    cy[j] = (double)blobs[j].y_sum / blobs[j].area;
+    det_used[j] = (blobs[j].area < BLOB_MIN_AREA);
+  }
+
+  for (i = 0; i < tr->ntracks; i++) {
+    kalman_predict(&tr->tracks[i].x, dt);
+    kalman_predict(&tr->tracks[i].y, dt);
+    for (j = 0; j < nblobs; j++) {
+      dist[i][j] = track_distance(&tr->tracks[i], cx[j], cy[j]);
+    }
+  }
+
+  // Greedy assignment, closest gated pair first
+  for (n = 0; n < tr->ntracks && n < nblobs; n++) {
+    int bi = -1, bj = -1;
+    double best = TRACK_GATE;
+
+    for (i = 0; i < tr->ntracks; i++) {
+      for (j = 0; !trk_used[i] && j < nblobs; j++) {
+        if (!det_used[j] && dist[i][j] < best) {
+          best = dist[i][j];
+          bi = i;
+          bj = j;
+        }
+      }
+    }
+    if (bi < 0) {
+      break;
+    }
+    track_t *t = &tr->tracks[bi];
+    kalman_correct(&t->x, cx[bj]);
+    kalman_correct(&t->y, cy[bj]);
+    track_set_size(t, &blobs[bj]);
+    t->hits++;
+    t->misses = 0;
+    trk_used[bi] = 1;
+    det_used[bj] = 1;
+  }
+
+  // Age out tracks that missed, compacting the array in place
+  for (i = 0, n = 0; i < tr->ntracks; i++) {
+    track_t *t = &tr->tracks[i];
+
+    if (!trk_used[i]) {
+      t->misses++;
+    }
+    if (t->misses > TRACK_MAX_MISSES || (t->hits < TRACK_CONFIRM && t->misses > 0)) {
+      continue;
+    }
+    tr->tracks[n++] = *t;
+  }
+  tr->ntracks = n;
+
+  // Detections nobody claimed start tentative tracks, largest first
+  for (j = 0; j < nblobs && tr->ntracks < TRACK_MAX; j++) {
+    if (det_used[j]) {
+      continue;
+    }
+    track_t *t = &tr->tracks[tr->ntracks++];
+    t->id = tr->next_id++;
+    kalman_init(&t->x, cx[j]);
+    kalman_init(&t->y, cy[j]);
+    track_set_size(t, &blobs[j]);
+    t->hits = 1;
+    t->misses = 0;
+  }
+}
+
+// Move every track by (dx, dy) pixels, for image motion that is not the
+// targets' own: the launcher turning the camera
+void tracker_shift(tracker_t *tr, double dx, double dy) {
+  for (int i = 0; i < tr->ntracks; i++) {
+    tr->tracks[i].x.pos += dx;
+    tr->tracks[i].y.pos += dy;
+  }
+}
+
+// The confirmed track to aim at. The current target is kept while it is
+// tracked; otherwise the largest confirmed track takes over.
+const track_t *tracker_target(tracker_t *tr) {
+  const track_t *best = NULL;
+
+  for (int i = 0; i < tr->ntracks; i++) {
+    const track_t *t = &tr->tracks[i];
+
+    if (t->hits < TRACK_CONFIRM) {
+      continue;
+    }
+    if (t->id == tr->target_id) {
+      return t;
+    }
+    if (best == NULL || t->area > best->area) {
+      best = t;
+    }
+  }
+  tr->target_id = best ? best->id : 0;
+  return best;
+}
+
+// Where the track is expected to be 'ahead' seconds after the last frame
+void track_predict(const track_t *t, double ahead, double *x, double *y) {
+  *x = t->x.pos + t->x.vel * ahead;
+  *y = t->y.pos + t->y.vel * ahead;
+}
+
+// Scan window for the next frame, 'ahead' seconds after the last one.
+// Returns 0 when the window would be so large that the full acquisition
+// scan is the better choice.
+int track_window(const track_t *t, double ahead, scan_window_t *w) {
+  kalman_axis_t x = t->x, y = t->y;
+  double half_x, half_y;
+  int grow = 1 << (t->misses < 8 ? t->misses : 8);
+
+  kalman_predict(&x, ahead);
+  kalman_predict(&y, ahead);
+  half_x = (t->width / 2 + TRACK_WIN_SIGMA * sqrt(x.p00 + TRACK_MEAS_VAR) + TRACK_WIN_MARGIN) * grow;
+  half_y = (t->height / 2 + TRACK_WIN_SIGMA * sqrt(y.p00 + TRACK_MEAS_VAR) + TRACK_WIN_MARGIN) * grow;
+  if (4 * half_x * half_y > TRACK_WIN_MAX_AREA * DISP_WIDTH * DISP_HEIGHT) {
+    return 0;
+  }
+
+  w->x0 = (int)(x.pos - half_x) & ~1;
+  w->x1 = ((int)(x.pos + half_x) + 2) & ~1;
+  w->y0 = (int)(y.pos - half_y);
+  w->y1 = (int)(y.pos + half_y) + 1;
+  if (w->x0 < 0) w->x0 = 0;
+  if (w->y0 < 0) w->y0 = 0;
+  if (w->x1 > DISP_WIDTH) w->x1 = DISP_WIDTH;
+  if (w->y1 > DISP_HEIGHT) w->y1 = DISP_HEIGHT;
+  return w->x1 > w->x0 && w->y1 > w->y0;
+}
@@ -0,0 +1,175 @@
+// integral_image.h - summed-area tables over byte images, shared by the MP2
+// camera application and the MP3 sentry. Header only, like pixel422.h.
+//
+// Entry (x, y) of the table holds the sum of every source byte above and to
+// the left of pixel (x, y), so the sum over any rectangle is four loads and
+// three adds however large it is. Row and column 0 of the table are zero,
+// which keeps rectangles touching the image edge free of special cases.
+//
+// The table is built one source row at a time, so it can be fed straight
+// from a scan without storing the image: each row is turned into its
+// running sum, eight bytes at a time with NEON or SSE2 (a log-step prefix
+// sum in 16-bit lanes, then widened and carried across), and added to the
+// table row above.
+
+#ifndef INTEGRAL_IMAGE_H
+#define INTEGRAL_IMAGE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define INTEGRAL_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define INTEGRAL_SSE2
+#endif
+
+// Words of table for a w x h image
+#define INTEGRAL_WORDS(w, h)       (((w) + 1) * ((h) + 1))
+
+// Entry (x, y) is at sum[y * stride + x], with stride = width + 1
+typedef struct {
+  int width, height;
+  int stride;
+  uint32_t *sum;
+} integral_t;
+
+
+// sum must hold INTEGRAL_WORDS(width, height) words
+static inline void integral_init(integral_t *ii, int width, int height, uint32_t *sum) {
+  ii->width = width;
+  ii->height = height;
+  ii->stride = width + 1;
+  ii->sum = sum;
+  memset(sum, 0, ii->stride * sizeof(uint32_t));
+}
+
+// out[i] = above[i] + run + src[0] + ... + src[i]
+static inline void integral_row_scalar(const uint8_t *src, int n, const uint32_t *above, uint32_t *out,
+                                       uint32_t run) {
+  for (int i = 0; i < n; i++) {
+    run += src[i];
+    out[i] = above[i] + run;
+  }
+}
+
+static inline void integral_row_simd(const uint8_t *src, int n, const uint32_t *above, uint32_t *out) {
+  int i = 0;
+  uint32_t run = 0;
+
+#if defined(INTEGRAL_NEON)
+  const uint16x8_t zero = vdupq_n_u16(0);
+  uint32x4_t carry = vdupq_n_u32(0);
+
+  for (; i + 8 <= n; i += 8) {
+    uint16x8_t v = vmovl_u8(vld1_u8(src + i));
+
+    // Each lane adds the lanes 1, 2 and 4 below it: eight bytes fit in 16 bits
+    v = vaddq_u16(v, vextq_u16(zero, v, 7));
+    v = vaddq_u16(v, vextq_u16(zero, v, 6));
+    v = vaddq_u16(v, vextq_u16(zero, v, 4));
+    uint32x4_t lo = vaddq_u32(vmovl_u16(vget_low_u16(v)), carry);
+    uint32x4_t hi = vaddq_u32(vmovl_u16(vget_high_u16(v)), carry);
+
+    vst1q_u32(out + i, vaddq_u32(lo, vld1q_u32(above + i)));
+    vst1q_u32(out + i + 4, vaddq_u32(hi, vld1q_u32(above + i + 4)));
+    carry = vdupq_n_u32(vgetq_lane_u32(hi, 3));
+  }
+  run = vgetq_lane_u32(carry, 0);
+#elif defined(INTEGRAL_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+  __m128i carry = zero;
+
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src + i)), zero);
+
+    v = _mm_add_epi16(v, _mm_slli_si128(v, 2));
+    v = _mm_add_epi16(v, _mm_slli_si128(v, 4));
+    v = _mm_add_epi16(v, _mm_slli_si128(v, 8));
+    __m128i lo = _mm_add_epi32(_mm_unpacklo_epi16(v, zero), carry);
+    __m128i hi = _mm_add_epi32(_mm_unpackhi_epi16(v, zero), carry);
+
+    _mm_storeu_si128((__m128i *)(out + i), _mm_add_epi32(lo, _mm_loadu_si128((const __m128i *)(above + i))));
+    _mm_storeu_si128((__m128i *)(out + i + 4), _mm_add_epi32(hi, _mm_loadu_si128((const __m128i *)(above + i + 4))));
+    carry = _mm_shuffle_epi32(hi, 0xFF);
+  }
+  run = (uint32_t)_mm_cvtsi128_si32(carry);
+#endif
+  integral_row_scalar(src + i, n - i, above + i, out + i, run);
+}
+
+// Add source row y (width bytes). Rows must come in order from 0.
+static inline void integral_row(integral_t *ii, int y, const uint8_t *src) {
+  uint32_t *out = &ii->sum[(y + 1) * ii->stride];
+
+  out[0] = 0;
+  integral_row_simd(src, ii->width, out - ii->stride + 1, out + 1);
+}
+
+// Whole image, rows stride bytes apart
+static inline void integral_build(integral_t *ii, const uint8_t *src, int stride) {
+  for (int y = 0; y < ii->height; y++) {
+    integral_row(ii, y, src + y * stride);
+  }
+}
+
+// Sum over [x0, x1) x [y0, y1), clipped to the image
+static inline uint32_t integral_sum(const integral_t *ii, int x0, int y0, int x1, int y1) {
+  const uint32_t *top, *bottom;
+
+  x0 = (x0 < 0) ? 0 : x0;
+  y0 = (y0 < 0) ? 0 : y0;
+  x1 = (x1 > ii->width) ? ii->width : x1;
+  y1 = (y1 > ii->height) ? ii->height : y1;
+  if (x1 <= x0 || y1 <= y0) {
+    return 0;
+  }
+  top = &ii->sum[y0 * ii->stride];
+  bottom = &ii->sum[y1 * ii->stride];
+  return bottom[x1] - bottom[x0] - top[x1] + top[x0];
+}
+
+// The w x h window with the largest sum; its corner goes to *x, *y. Ties go
+// to the first in row order.
+static inline uint32_t integral_densest(const integral_t *ii, int w, int h, int *x, int *y) {
+  uint32_t best = 0;
+
+  *x = *y = 0;
+  for (int y0 = 0; y0 + h <= ii->height; y0++) {
+    const uint32_t *top = &ii->sum[y0 * ii->stride];
+    const uint32_t *bottom = &ii->sum[(y0 + h) * ii->stride];
+
+    for (int x0 = 0; x0 + w <= ii->width; x0++) {
+      uint32_t s = bottom[x0 + w] - bottom[x0] - top[x0 + w] + top[x0];
+
+      if (s > best) {
+        best = s;
+        *x = x0;
+        *y = y0;
+      }
+    }
+  }
+  return best;
+}
+
+// Replace every pixel of img (ii's size, rows stride bytes apart) by the
+// mean of the (2 * radius + 1)^2 box around it, clipped at the edges. Costs
+// the same for any radius; ii is left holding the table of the original.
+static inline void integral_box_blur(integral_t *ii, uint8_t *img, int stride, int radius) {
+  integral_build(ii, img, stride);
+  for (int y = 0; y < ii->height; y++) {
+    int y0 = (y - radius < 0) ? 0 : y - radius;
+    int y1 = (y + radius + 1 > ii->height) ? ii->height : y + radius + 1;
+
+    for (int x = 0; x < ii->width; x++) {
+      int x0 = (x - radius < 0) ? 0 : x - radius;
+      int x1 = (x + radius + 1 > ii->width) ? ii->width : x + radius + 1;
+
+      img[y * stride + x] = integral_sum(ii, x0, y0, x1, y1) / ((x1 - x0) * (y1 - y0));
+    }
+  }
+}
+
+#endif // INTEGRAL_IMAGE_H
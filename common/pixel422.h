@@ -0,0 +1,226 @@
+// pixel422.h - packed 4:2:2 pixels, shared by the MP2 camera application
+// and the MP3 sentry. Header only; add this directory to the include path
+// (gcc -I../common, or the SDK project's include directories).
+//
+// The VDMA frame buffers hold two pixels in each 32-bit word, bytes Y0, Cb,
+// Y1, Cr in memory order, so a little-endian word reads [Cr][Y1][Cb][Y0].
+// The camera application's 16-bit view of the same memory is (Cb << 8 | Y)
+// for even pixels and (Cr << 8 | Y) for odd ones. Both pixels of a word
+// share its Cb and Cr.
+//
+// A view is a rectangle of pairs in frame memory, read in place and
+// clipped to the frame it was cut from, which keeps kernels free of edge
+// checks; iterators walk it a pair at a time. For whole rows, pix422_unpack
+// and pix422_pack convert between words and separate Y, Cb and Cr planes
+// (Y at full width, Cb and Cr at half), eight pairs at a time with NEON or
+// SSE2.
+
+#ifndef PIXEL422_H
+#define PIXEL422_H
+
+#include <stdint.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PIX422_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PIX422_SSE2
+#endif
+
+typedef struct {
+  uint8_t y0, cb, y1, cr;
+} pix422_pair_t;
+
+// A rectangle of frame memory, whole pairs wide
+typedef struct {
+  const uint32_t *words;        // First pair of the first row
+  int x0, y0;                   // Where that is in the whole frame
+  int width, height;            // Pixels; width is even
+  int stride;                   // Words from one row to the next
+} pix422_view_t;
+
+// Walks a view row by row, a pair at a time
+typedef struct {
+  const pix422_view_t *view;
+  int x, y;                     // Position in the view of the last pair returned
+  int next_col, next_row;       // Pair index of the next one
+} pix422_iter_t;
+
+
+static inline int pix422_y0(uint32_t w) { return w & 0xFF; }
+static inline int pix422_y1(uint32_t w) { return (w >> 16) & 0xFF; }
+static inline int pix422_cb(uint32_t w) { return (w >> 8) & 0xFF; }
+static inline int pix422_cr(uint32_t w) { return w >> 24; }
+
+// Y of the even (odd = 0) or odd pixel of a pair
+static inline int pix422_y(uint32_t w, int odd) {
+  return (w >> (odd ? 16 : 0)) & 0xFF;
+}
+
+static inline uint32_t pix422_word(int y0, int cb, int y1, int cr) {
+  return (uint32_t)cr << 24 | (uint32_t)y1 << 16 | (uint32_t)cb << 8 | (uint32_t)y0;
+}
+
+static inline pix422_pair_t pix422_pair(uint32_t w) {
+  pix422_pair_t p = {(uint8_t)pix422_y0(w), (uint8_t)pix422_cb(w), (uint8_t)pix422_y1(w), (uint8_t)pix422_cr(w)};
+
+  return p;
+}
+
+
+// A view of a whole frame (stride in words, usually width / 2)
+static inline pix422_view_t pix422_view(const void *base, int width, int height, int stride) {
+  pix422_view_t v = {(const uint32_t *)base, 0, 0, width, height, stride};
+
+  return v;
+}
+
+// [x0, x1) x [y0, y1) of v (in v's coordinates), widened to whole pairs and
+// clipped to v
+static inline pix422_view_t pix422_window(const pix422_view_t *v, int x0, int y0, int x1, int y1) {
+  pix422_view_t w;
+
+  x0 = (x0 < 0) ? 0 : x0 & ~1;
+  y0 = (y0 < 0) ? 0 : y0;
+  x1 = (x1 > v->width) ? v->width : (x1 + 1) & ~1;
+  y1 = (y1 > v->height) ? v->height : y1;
+  w.words = v->words + y0 * v->stride + x0 / 2;
+  w.x0 = v->x0 + x0;
+  w.y0 = v->y0 + y0;
+  w.width = (x1 > x0) ? x1 - x0 : 0;
+  w.height = (y1 > y0) ? y1 - y0 : 0;
+  w.stride = v->stride;
+  return w;
+}
+
+static inline const uint32_t *pix422_row(const pix422_view_t *v, int y) {
+  return v->words + y * v->stride;
+}
+
+// The word holding pixel (x, y) of the view
+static inline uint32_t pix422_word_at(const pix422_view_t *v, int x, int y) {
+  return v->words[y * v->stride + x / 2];
+}
+
+static inline int pix422_y_at(const pix422_view_t *v, int x, int y) {
+  return pix422_y(pix422_word_at(v, x, y), x & 1);
+}
+
+
+static inline pix422_iter_t pix422_begin(const pix422_view_t *v) {
+  pix422_iter_t it = {v, -2, 0, 0, 0};
+
+  return it;
+}
+
+// The next pair into p, its pixel position into it->x, it->y. Returns 0
+// once the view is done.
+static inline int pix422_next(pix422_iter_t *it, pix422_pair_t *p) {
+  const pix422_view_t *v = it->view;
+
+  if (it->next_col == v->width / 2) {
+    it->next_col = 0;
+    it->next_row++;
+  }
+  if (it->next_row >= v->height || v->width < 2) {
+    return 0;
+  }
+  *p = pix422_pair(v->words[it->next_row * v->stride + it->next_col]);
+  it->x = 2 * it->next_col++;
+  it->y = it->next_row;
+  return 1;
+}
+
+
+// n pairs of words to planes: 2n bytes of Y, n each of Cb and Cr
+static inline void pix422_unpack(const uint32_t *src, int n, uint8_t *y, uint8_t *cb, uint8_t *cr) {
+  int i = 0;
+
+#if defined(PIX422_NEON)
+  for (; i + 8 <= n; i += 8) {
+    uint8x8x4_t v = vld4_u8((const uint8_t *)(src + i));   // Y0, Cb, Y1, Cr
+    uint8x8x2_t yy = {{v.val[0], v.val[2]}};
+
+    vst2_u8(y + 2 * i, yy);
+    vst1_u8(cb + i, v.val[1]);
+    vst1_u8(cr + i, v.val[3]);
+  }
+#elif defined(PIX422_SSE2)
+  const __m128i lo = _mm_set1_epi16(0xFF);
+
+  for (; i + 8 <= n; i += 8) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 4));
+    // Chroma as 16-bit Cr:Cb lanes, one per pair
+    __m128i c = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+
+    _mm_storeu_si128((__m128i *)(y + 2 * i), _mm_packus_epi16(_mm_and_si128(a, lo), _mm_and_si128(b, lo)));
+    _mm_storel_epi64((__m128i *)(cb + i), _mm_packus_epi16(_mm_and_si128(c, lo), _mm_setzero_si128()));
+    _mm_storel_epi64((__m128i *)(cr + i), _mm_packus_epi16(_mm_srli_epi16(c, 8), _mm_setzero_si128()));
+  }
+#endif
+  for (; i < n; i++) {
+    uint32_t w = src[i];
+
+    y[2 * i] = pix422_y0(w);
+    y[2 * i + 1] = pix422_y1(w);
+    cb[i] = pix422_cb(w);
+    cr[i] = pix422_cr(w);
+  }
+}
+
+// n pairs of words to their 2n bytes of Y only
+static inline void pix422_unpack_y(const uint32_t *src, int n, uint8_t *y) {
+  int i = 0;
+
+#if defined(PIX422_NEON)
+  for (; i + 8 <= n; i += 8) {
+    uint8x8x4_t v = vld4_u8((const uint8_t *)(src + i));
+    uint8x8x2_t yy = {{v.val[0], v.val[2]}};
+
+    vst2_u8(y + 2 * i, yy);
+  }
+#elif defined(PIX422_SSE2)
+  const __m128i lo = _mm_set1_epi16(0xFF);
+
+  for (; i + 8 <= n; i += 8) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 4));
+
+    _mm_storeu_si128((__m128i *)(y + 2 * i), _mm_packus_epi16(_mm_and_si128(a, lo), _mm_and_si128(b, lo)));
+  }
+#endif
+  for (; i < n; i++) {
+    y[2 * i] = pix422_y0(src[i]);
+    y[2 * i + 1] = pix422_y1(src[i]);
+  }
+}
+
+// Planes back to n pairs of words
+static inline void pix422_pack(const uint8_t *y, const uint8_t *cb, const uint8_t *cr, int n, uint32_t *dst) {
+  int i = 0;
+
+#if defined(PIX422_NEON)
+  for (; i + 8 <= n; i += 8) {
+    uint8x8x2_t yy = vld2_u8(y + 2 * i);
+    uint8x8x4_t v = {{yy.val[0], vld1_u8(cb + i), yy.val[1], vld1_u8(cr + i)}};
+
+    vst4_u8((uint8_t *)(dst + i), v);
+  }
+#elif defined(PIX422_SSE2)
+  for (; i + 8 <= n; i += 8) {
+    __m128i yy = _mm_loadu_si128((const __m128i *)(y + 2 * i));
+    __m128i c = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(cb + i)),
+                                  _mm_loadl_epi64((const __m128i *)(cr + i)));   // Cb, Cr, ...
+
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi8(yy, c));
+    _mm_storeu_si128((__m128i *)(dst + i + 4), _mm_unpackhi_epi8(yy, c));
+  }
+#endif
+  for (; i < n; i++) {
+    dst[i] = pix422_word(y[2 * i], cb[i], y[2 * i + 1], cr[i]);
+  }
+}
+
+#endif // PIXEL422_H